@@ -0,0 +1,554 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+#include <vector>
+#include <SFML/System/Clock.hpp>
+#include "Network.h"
+#include "MessagePool.h"
+#include "SendWindow.h"
+#include "BitStream.h"
+#include "GameParams.h"
+
+// Number of acknowledgements timed for each case
+#define BENCH_ACKS 2000000
+
+// Size of the messages put in the send window
+#define BENCH_ACK_MESSAGE_SIZE 16
+
+// Size of the messages sent over the loopback interface, more than half
+// of a datagram so that no two share one
+#define BENCH_LOOPBACK_MESSAGE_SIZE (NETWORK_MTU / 2 + 1)
+
+// In seconds, longest to wait for the loopback connection to be made
+#define BENCH_CONNECT_TIMEOUT 2.0
+
+// Number of values sent through each quantization round trip check,
+// and how many go in each message
+#define BENCH_QUANTIZE_VALUES 1000000
+#define BENCH_QUANTIZE_BATCH 1000
+
+// Number of players encoded and decoded for the throughput, and how
+// many of them go in each message, like a snapshot
+#define BENCH_PLAYERS 2000000
+#define BENCH_PLAYERS_PER_MESSAGE 32
+
+/*
+ * Time acknowledging guaranteed messages with different numbers of
+ * them in flight, in the order they were sent and in a random order.
+ * The send window finds a message by its sequence number, so the time
+ * per ACK should stay the same however many are in flight, and however
+ * many more are waiting behind a full window.
+ */
+static void benchmark_acks()
+{
+    // Messages in flight, and waiting in the backlog
+    const unsigned int cases[][2] = {
+        {16u, 0u},
+        {128u, 0u},
+        {SEND_WINDOW_SIZE, 0u},
+        {SEND_WINDOW_SIZE, 4u * SEND_WINDOW_SIZE}
+    };
+    MessagePool pool(BENCH_ACK_MESSAGE_SIZE);
+    SendWindow window(&pool);
+    std::vector<sf::Uint16> order;
+    srand(1);
+    printf("%9s %8s %10s %12s %12s\n", "in flight", "backlog", "acks", "in order", "shuffled");
+    for(unsigned int c = 0; c < (sizeof(cases) / sizeof(cases[0])); c++)
+    {
+        unsigned int in_flight = cases[c][0];
+        unsigned int queued = in_flight + cases[c][1];
+        unsigned int rounds = BENCH_ACKS / queued;
+        double seconds[2] = {0.0, 0.0};
+        unsigned int missed = 0u;
+        for(int shuffled = 0; shuffled < 2; shuffled++)
+        {
+            for(unsigned int round = 0; round < rounds; round++)
+            {
+                sf::Uint16 first = window.getNext();
+                order.clear();
+                for(unsigned int i = 0; i < queued; i++)
+                {
+                    window.push((sf::Uint8)NETWORK_GUARANTEED, pool.acquire(BENCH_ACK_MESSAGE_SIZE));
+                    order.push_back(first + i);
+                }
+                // Only the messages in the window can be acknowledged,
+                // so each window's worth is shuffled on its own
+                for(unsigned int i = 0; shuffled && (i < queued); i += in_flight)
+                {
+                    std::random_shuffle(order.begin() + i, order.begin() + std::min(i + in_flight, queued));
+                }
+                sf::Clock timer;
+                for(unsigned int i = 0; i < queued; i++)
+                {
+                    if(!window.acknowledge(order[i]))
+                    {
+                        missed++;
+                    }
+                }
+                seconds[shuffled] += timer.getElapsedTime().asSeconds();
+            }
+        }
+        double acks = (double)rounds * queued;
+        printf("%9u %8u %10.0f %9.1f ns %9.1f ns\n", in_flight, cases[c][1], acks,
+               seconds[0] * 1000000000.0 / acks, seconds[1] * 1000000000.0 / acks);
+        if(missed > 0u)
+        {
+            printf("  %u acknowledgements did not find their message\n", missed);
+        }
+    }
+}
+
+static void exchange(Network& from, Network& to)
+{
+    from.Transmit();
+    to.Receive();
+}
+
+/*
+ * Send datagrams from one network to another over the loopback
+ * interface for the given number of seconds, a batch at a time, first
+ * with sendmmsg()/recvmmsg() and then with the plain socket calls.
+ * Each message takes a datagram of its own.  Both ends run in this
+ * thread, so the CPU time per datagram covers sending and receiving it.
+ */
+static bool benchmark_loopback(double duration)
+{
+    sf::Packet message;
+    std::vector<char> payload(BENCH_LOOPBACK_MESSAGE_SIZE, 'x');
+    message.append(&payload[0], payload.size());
+    sf::Packet received;
+
+    printf("%-8s %10s %10s %7s %12s %14s\n", "calls", "sent", "received", "lost", "per second", "CPU per datagram");
+    for(int batched = 1; batched >= 0; batched--)
+    {
+        Network server;
+        Network client;
+        server.Create(sf::Socket::AnyPort, sf::IpAddress::None);
+        client.Create(server.getLocalPort(), "127.0.0.1");
+        server.setBatchedIo(batched);
+        client.setBatchedIo(batched);
+
+        sf::Clock timer;
+        while((client.getClientState(NETWORK_CLIENT_ID(0u, 0u)) != CONNECTED) &&
+              (timer.getElapsedTime().asSeconds() < BENCH_CONNECT_TIMEOUT))
+        {
+            exchange(client, server);
+            exchange(server, client);
+            sf::sleep(sf::milliseconds(1));
+        }
+        if(client.getClientState(NETWORK_CLIENT_ID(0u, 0u)) != CONNECTED)
+        {
+            return false;
+        }
+
+        sf::Uint32 sent = client.getCoalesceStats().datagrams_sent;
+        sf::Uint32 num_received = 0u;
+        std::clock_t cpu_start = std::clock();
+        timer.restart();
+        while(timer.getElapsedTime().asSeconds() < duration)
+        {
+            for(int i = 0; i < NETWORK_BATCH_SIZE; i++)
+            {
+                client.sendData(message);
+            }
+            exchange(client, server);
+            while(server.getData(received))
+            {
+                num_received++;
+            }
+            exchange(server, client);
+        }
+        double seconds = timer.getElapsedTime().asSeconds();
+        double cpu_seconds = (double)(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+        sent = client.getCoalesceStats().datagrams_sent - sent;
+
+        // The kernel may not have the batched calls after all
+        const char *calls = "plain";
+        if(batched)
+        {
+            calls = (client.isBatchedIo() && server.isBatchedIo()) ? "batched" : "batched, not supported";
+        }
+        printf("%-8s %10u %10u %6.2f%% %12.0f %11.2f us\n", calls, sent, num_received,
+               (sent > 0u) ? (100.0 * (sent - std::min(sent, num_received)) / sent) : 0.0,
+               num_received / seconds, (num_received > 0u) ? (cpu_seconds * 1000000.0 / num_received) : 0.0);
+        client.Destroy();
+        server.Destroy();
+    }
+    return true;
+}
+
+static double random_between(double min, double max)
+{
+    return min + (max - min) * rand() / RAND_MAX;
+}
+
+static sf::Uint32 random_bits(unsigned int bits)
+{
+    sf::Uint32 value = ((sf::Uint32)rand() << 16) ^ (sf::Uint32)rand();
+    return (bits >= 32u) ? value : (value & (((sf::Uint32)1u << bits) - 1u));
+}
+
+static bool report_check(const char *name, unsigned int bits, double step, double worst, unsigned int failures)
+{
+    printf("%-14s %2u bits  step %10.6f  max error %10.6f  %s\n", name, bits, step, worst,
+           (0u == failures) ? "ok" : "FAILED");
+    return (0u == failures);
+}
+
+/*
+ * Send values, about a twentieth of them outside the range, and the
+ * ends of the range themselves, through writeQuantized() and readQuantized().
+ * None may come back more than half a step from the value, or for one
+ * outside the range, from the end it was clamped to.
+ */
+static bool check_quantized(const char *name, double min, double max, unsigned int bits)
+{
+    double step = (max - min) / (double)((((sf::Uint64)1u) << bits) - 1u);
+    double outside = (max - min) / 40.0;
+    double values[BENCH_QUANTIZE_BATCH];
+    BitWriter writer;
+    sf::Packet packet;
+    double worst = 0.0;
+    unsigned int failures = 0u;
+    for(int done = 0; done < BENCH_QUANTIZE_VALUES; done += BENCH_QUANTIZE_BATCH)
+    {
+        for(int i = 0; i < BENCH_QUANTIZE_BATCH; i++)
+        {
+            values[i] = random_between(min - outside, max + outside);
+        }
+        if(0 == done)
+        {
+            values[0] = min;
+            values[1] = max;
+        }
+        writer.clear();
+        for(int i = 0; i < BENCH_QUANTIZE_BATCH; i++)
+        {
+            writer.writeQuantized(values[i], min, max, bits);
+        }
+        packet.clear();
+        writer.appendTo(packet);
+        BitReader reader(packet.getData(), packet.getDataSize());
+        for(int i = 0; i < BENCH_QUANTIZE_BATCH; i++)
+        {
+            double expected = std::min(std::max(values[i], min), max);
+            double error = fabs(reader.readQuantized(min, max, bits) - expected);
+            worst = std::max(worst, error);
+            if(error > (step * 0.5 * (1.0 + 1e-9)))
+            {
+                failures++;
+            }
+        }
+        if(reader.overflowed())
+        {
+            failures++;
+        }
+    }
+    return report_check(name, bits, step, worst, failures);
+}
+
+// Angles of any size, which come back as the same direction to within
+// half a step
+static bool check_angle(const char *name, unsigned int bits)
+{
+    double step = 2.0 * M_PI / (double)((sf::Uint32)1u << bits);
+    double values[BENCH_QUANTIZE_BATCH];
+    BitWriter writer;
+    sf::Packet packet;
+    double worst = 0.0;
+    unsigned int failures = 0u;
+    for(int done = 0; done < BENCH_QUANTIZE_VALUES; done += BENCH_QUANTIZE_BATCH)
+    {
+        writer.clear();
+        for(int i = 0; i < BENCH_QUANTIZE_BATCH; i++)
+        {
+            values[i] = random_between(-4.0 * M_PI, 4.0 * M_PI);
+            writer.writeAngle(values[i], bits);
+        }
+        packet.clear();
+        writer.appendTo(packet);
+        BitReader reader(packet.getData(), packet.getDataSize());
+        for(int i = 0; i < BENCH_QUANTIZE_BATCH; i++)
+        {
+            double angle = reader.readAngle(bits);
+            if((angle < 0.0) || (angle >= (2.0 * M_PI)))
+            {
+                failures++;
+            }
+            double error = fmod(fabs(angle - values[i]), 2.0 * M_PI);
+            error = std::min(error, 2.0 * M_PI - error);
+            worst = std::max(worst, error);
+            if(error > (step * 0.5 * (1.0 + 1e-9)))
+            {
+                failures++;
+            }
+        }
+    }
+    return report_check(name, bits, step, worst, failures);
+}
+
+// Signed integers come back exactly, or clamped if out of range
+static bool check_signed(const char *name, unsigned int bits)
+{
+    sf::Int32 limit = (sf::Int32)(((sf::Uint32)1u << (bits - 1u)) - 1u);
+    sf::Int32 values[BENCH_QUANTIZE_BATCH];
+    BitWriter writer;
+    sf::Packet packet;
+    double worst = 0.0;
+    unsigned int failures = 0u;
+    for(int done = 0; done < BENCH_QUANTIZE_VALUES; done += BENCH_QUANTIZE_BATCH)
+    {
+        writer.clear();
+        for(int i = 0; i < BENCH_QUANTIZE_BATCH; i++)
+        {
+            values[i] = (sf::Int32)floor(random_between(-1.1 * limit, 1.1 * limit));
+            writer.writeSigned(values[i], bits);
+        }
+        packet.clear();
+        writer.appendTo(packet);
+        BitReader reader(packet.getData(), packet.getDataSize());
+        for(int i = 0; i < BENCH_QUANTIZE_BATCH; i++)
+        {
+            sf::Int32 expected = std::min(std::max(values[i], -limit), limit);
+            double error = fabs((double)(reader.readSigned(bits) - expected));
+            worst = std::max(worst, error);
+            if(error > 0.0)
+            {
+                failures++;
+            }
+        }
+    }
+    return report_check(name, bits, 1.0, worst, failures);
+}
+
+// Values of every width from 1 to 32 bits, packed one after another,
+// come back exactly, and reading on past the end is noticed
+static bool check_packing()
+{
+    unsigned int widths[BENCH_QUANTIZE_BATCH];
+    sf::Uint32 values[BENCH_QUANTIZE_BATCH];
+    BitWriter writer;
+    sf::Packet packet;
+    unsigned int failures = 0u;
+    for(int done = 0; done < BENCH_QUANTIZE_VALUES; done += BENCH_QUANTIZE_BATCH)
+    {
+        writer.clear();
+        for(int i = 0; i < BENCH_QUANTIZE_BATCH; i++)
+        {
+            widths[i] = 1u + (rand() % 32);
+            values[i] = random_bits(widths[i]);
+            writer.write(values[i], widths[i]);
+        }
+        packet.clear();
+        writer.appendTo(packet);
+        BitReader reader(packet.getData(), packet.getDataSize());
+        for(int i = 0; i < BENCH_QUANTIZE_BATCH; i++)
+        {
+            if(reader.read(widths[i]) != values[i])
+            {
+                failures++;
+            }
+        }
+        // Only the padding of the last byte is left
+        if(reader.overflowed())
+        {
+            failures++;
+        }
+        reader.read(8u);
+        if(!reader.overflowed())
+        {
+            failures++;
+        }
+    }
+    return report_check("packing", 32u, 1.0, 0.0, failures);
+}
+
+typedef struct{
+    sf::Uint8 pindex;
+    double x;
+    double y;
+    double direction;
+    double hover;
+} Bench_Player_t;
+
+/*
+ * Time packing players into messages, as the server does for its
+ * snapshots, and reading them back, against the sf::Packet of doubles
+ * that the bit packing replaced.
+ */
+static void benchmark_encoding()
+{
+    std::vector<Bench_Player_t> players(BENCH_PLAYERS_PER_MESSAGE);
+    for(unsigned int i = 0; i < players.size(); i++)
+    {
+        players[i].pindex = i + 1u;
+        players[i].x = random_between(NET_COORD_MIN, NET_COORD_MAX);
+        players[i].y = random_between(NET_COORD_MIN, NET_COORD_MAX);
+        players[i].direction = random_between(0.0, 2.0 * M_PI);
+        players[i].hover = random_between(0.0, 1.0);
+    }
+    const int messages = BENCH_PLAYERS / BENCH_PLAYERS_PER_MESSAGE;
+    BitWriter writer;
+    sf::Packet packet;
+    Bench_Player_t player;
+    // Kept so the decoding is not left out by the compiler
+    double total = 0.0;
+
+    printf("%-12s %8s %14s %14s\n", "format", "bytes", "encode", "decode");
+    for(int packed = 1; packed >= 0; packed--)
+    {
+        double encode_seconds = 0.0;
+        double decode_seconds = 0.0;
+        std::size_t bytes = 0u;
+        for(int m = 0; m < messages; m++)
+        {
+            sf::Clock timer;
+            packet.clear();
+            if(packed)
+            {
+                writer.clear();
+                for(unsigned int i = 0; i < players.size(); i++)
+                {
+                    writer.write(players[i].pindex, 8u);
+                    writer.writeQuantized(players[i].x, NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+                    writer.writeQuantized(players[i].y, NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+                    writer.writeAngle(players[i].direction, NET_ANGLE_BITS);
+                    writer.writeQuantized(players[i].hover, 0.0, 1.0, NET_HOVER_BITS);
+                }
+                writer.appendTo(packet);
+            }
+            else
+            {
+                for(unsigned int i = 0; i < players.size(); i++)
+                {
+                    packet << players[i].pindex << players[i].x << players[i].y
+                           << players[i].direction << players[i].hover;
+                }
+            }
+            encode_seconds += timer.getElapsedTime().asSeconds();
+            bytes += packet.getDataSize();
+
+            timer.restart();
+            if(packed)
+            {
+                BitReader reader(packet.getData(), packet.getDataSize());
+                for(unsigned int i = 0; i < players.size(); i++)
+                {
+                    player.pindex = reader.read(8u);
+                    player.x = reader.readQuantized(NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+                    player.y = reader.readQuantized(NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+                    player.direction = reader.readAngle(NET_ANGLE_BITS);
+                    player.hover = reader.readQuantized(0.0, 1.0, NET_HOVER_BITS);
+                    total += player.x + player.hover;
+                }
+            }
+            else
+            {
+                for(unsigned int i = 0; i < players.size(); i++)
+                {
+                    packet >> player.pindex >> player.x >> player.y >> player.direction >> player.hover;
+                    total += player.x + player.hover;
+                }
+            }
+            decode_seconds += timer.getElapsedTime().asSeconds();
+        }
+        double num_players = (double)messages * players.size();
+        printf("%-12s %8.2f %11.1f ns %11.1f ns\n", packed ? "bit packed" : "sf::Packet",
+               bytes / num_players, encode_seconds * 1000000000.0 / num_players,
+               decode_seconds * 1000000000.0 / num_players);
+    }
+    if(total < 0.0)
+    {
+        printf("%f\n", total);
+    }
+}
+
+/*
+ * Check that every kind of quantized value in the game messages comes
+ * back to within half a step, then time encoding and decoding players.
+ */
+static bool benchmark_quantize()
+{
+    bool ok = true;
+    srand(1);
+    ok = check_quantized("coordinate", NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS) && ok;
+    ok = check_quantized("hover", 0.0, 1.0, NET_HOVER_BITS) && ok;
+    ok = check_quantized("shot distance", 0.0, MAX_SHOT_DISTANCE, NET_SHOT_DISTANCE_BITS) && ok;
+    ok = check_angle("angle", NET_ANGLE_BITS) && ok;
+    ok = check_signed("mouse", NET_MOUSE_BITS) && ok;
+    ok = check_packing() && ok;
+    benchmark_encoding();
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    bool acks = false;
+    bool loopback = false;
+    bool quantize = false;
+    double duration = 5.0;
+    for (;;)
+    {
+        static struct option long_options[] = {
+            {"acks", no_argument, 0, 'a'},
+            {"loopback", no_argument, 0, 'l'},
+            {"quantize", no_argument, 0, 'q'},
+            {"duration", required_argument, 0, 'd'},
+            {NULL, 0, 0, 0}
+        };
+        int opt_index = 0;
+        int c = getopt_long(argc, argv, "alqd:",
+                long_options, &opt_index);
+        if (c == -1)
+            break;
+        switch (c)
+        {
+            case 'a':
+                acks = true;
+                break;
+            case 'l':
+                loopback = true;
+                break;
+            case 'q':
+                quantize = true;
+                break;
+            case 'd':
+                duration = atof(optarg);
+                break;
+        }
+    }
+    if (!acks && !loopback && !quantize)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--acks] [--loopback] [--quantize] [--duration seconds]\n";
+        return 1;
+    }
+
+    if (acks)
+    {
+        benchmark_acks();
+    }
+
+    if (loopback)
+    {
+        if (!benchmark_loopback(duration))
+        {
+            std::cerr << "Could not connect over the loopback interface\n";
+            return 1;
+        }
+    }
+
+    if (quantize)
+    {
+        if (!benchmark_quantize())
+        {
+            std::cerr << "Quantized values did not survive the round trip\n";
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+#include "Bot.h"
+#include "Types.h"
+#include "GameParams.h"
+#include "BitStream.h"
+
+// Seconds between the bot picking new input, at most
+#define BOT_MAX_INPUT_INTERVAL 2.0
+
+// Chance of firing each time new input is picked
+#define BOT_SHOT_CHANCE 0.3
+
+Bot::Bot(const std::string& name, sf::Uint32 seed)
+{
+    m_name = name;
+    m_rng = (0u != seed) ? seed : 1u;
+    m_pindex = 0u;
+    m_have_state = false;
+    m_keys = 0u;
+    m_rel_mouse_movement = 0;
+    m_input_changed = false;
+    m_moving = false;
+    m_next_input = 0.0;
+    m_connect_time = 0.0;
+    m_input_time = 0.0;
+    m_shot_time = 0.0;
+    m_shot_allowed = true;
+}
+
+// Uniform in [0, 1), from a xorshift generator so runs can be repeated
+double Bot::random()
+{
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 17;
+    m_rng ^= m_rng << 5;
+    return m_rng / 4294967296.0;
+}
+
+void Bot::connect(const sf::IpAddress& host, sf::Uint16 port, const NetSim_Config_t& netsim)
+{
+    sf::Packet connect_packet;
+    sf::Uint8 packet_type = PLAYER_CONNECT;
+    sf::Uint16 players_port;
+
+    m_net = new Network();
+    m_net->Create(port, host);
+    m_net->setNetSim(netsim);
+    m_pindex = 0u;
+    m_snapshots.clear();
+
+    // The local port identifies our player in the server's reply
+    players_port = m_net->getLocalPort();
+    connect_packet << packet_type;
+    connect_packet << m_pindex;
+    connect_packet << m_name;
+    connect_packet << players_port;
+    m_net->sendData(connect_packet, true);
+    m_connect_time = -1.0;
+}
+
+void Bot::disconnect()
+{
+    if(connected())
+    {
+        sf::Packet disconnect_packet;
+        sf::Uint8 packet_type = PLAYER_DISCONNECT;
+        disconnect_packet << packet_type;
+        disconnect_packet << m_pindex;
+        m_net->sendData(disconnect_packet, true);
+        m_net->Transmit();
+    }
+}
+
+void Bot::update(double current_time, Bot_Stats_t& stats)
+{
+    if(m_connect_time < 0.0)
+    {
+        m_connect_time = current_time;
+    }
+
+    m_net->Receive();
+    process_messages(current_time, stats);
+
+    if(connected())
+    {
+        if(current_time >= m_next_input)
+        {
+            choose_input(current_time);
+            if(m_shot_allowed && (random() < BOT_SHOT_CHANCE))
+            {
+                fire(current_time, stats);
+            }
+        }
+        send_input(current_time, stats);
+    }
+
+    m_net->Transmit();
+}
+
+void Bot::process_messages(double current_time, Bot_Stats_t& stats)
+{
+    sf::Packet packet;
+    while(m_net->getData(packet))
+    {
+        sf::Uint8 packet_type;
+        packet >> packet_type;
+        stats.messages_received++;
+        switch(packet_type)
+        {
+            case PLAYER_CONNECT:
+            {
+                sf::Uint8 pindex;
+                std::string name;
+                sf::Uint16 players_port;
+                packet >> pindex;
+                packet >> name;
+                packet >> players_port;
+                if((0u == m_pindex) && (name == m_name) &&
+                   (players_port == m_net->getLocalPort()))
+                {
+                    m_pindex = pindex;
+                    stats.connect_times.push_back(current_time - m_connect_time);
+                }
+                break;
+            }
+            case WORLD_SNAPSHOT:
+            {
+                BitReader reader((const char *)packet.getData() + 1, packet.getDataSize() - 1);
+                Snapshot snapshot;
+                if(snapshot.decode(reader, m_snapshots))
+                {
+                    m_snapshots.store(snapshot);
+                    stats.snapshots_received++;
+
+                    // The server has acted on our input once our own
+                    // tank changes.
+                    std::map<sf::Uint8, Snapshot_Player_t>::iterator me = snapshot.players.find(m_pindex);
+                    if(snapshot.players.end() != me)
+                    {
+                        if(m_have_state && (m_input_time > 0.0) &&
+                           ((me->second.x != m_state.x) || (me->second.y != m_state.y) ||
+                            (me->second.direction != m_state.direction)))
+                        {
+                            stats.input_times.push_back(current_time - m_input_time);
+                            m_input_time = 0.0;
+                        }
+                        m_state = me->second;
+                        m_have_state = true;
+                    }
+
+                    sf::Packet ack_packet;
+                    sf::Uint8 ack_type = SNAPSHOT_ACK;
+                    ack_packet << ack_type;
+                    ack_packet << m_pindex;
+                    ack_packet << snapshot.id;
+                    m_net->sendData(ack_packet);
+                    stats.messages_sent++;
+                }
+                break;
+            }
+            case PLAYER_SHOT:
+            {
+                BitReader reader((const char *)packet.getData() + 1, packet.getDataSize() - 1);
+                sf::Uint8 pindex = reader.read(8);
+                if((pindex == m_pindex) && (m_shot_time > 0.0))
+                {
+                    stats.shot_times.push_back(current_time - m_shot_time);
+                    m_shot_time = 0.0;
+                }
+                break;
+            }
+            case TILE_DAMAGED:
+            {
+                float x;
+                float y;
+                sf::Uint8 pindex;
+                packet >> x;
+                packet >> y;
+                packet >> pindex;
+                if(pindex == m_pindex)
+                {
+                    m_shot_allowed = true;
+                }
+                break;
+            }
+            case PLAYER_DEATH:
+            {
+                sf::Uint8 pindex;
+                packet >> pindex;
+                if(pindex == m_pindex)
+                {
+                    // Stop moving, there is nothing more to measure
+                    m_keys = 0u;
+                    m_next_input = 1.0e30;
+                    m_input_time = 0.0;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+// Pick random keys and mouse movement to hold for a while
+void Bot::choose_input(double current_time)
+{
+    sf::Uint32 keys = 0u;
+    double r = random();
+    if(r < 0.5)
+    {
+        keys |= KEY_MASK_W;
+    }
+    else if(r < 0.7)
+    {
+        keys |= KEY_MASK_S;
+    }
+    r = random();
+    if(r < 0.25)
+    {
+        keys |= KEY_MASK_A;
+    }
+    else if(r < 0.5)
+    {
+        keys |= KEY_MASK_D;
+    }
+    sf::Int32 rel_mouse_movement = 0;
+    if(random() < 0.3)
+    {
+        rel_mouse_movement = (sf::Int32)(random() * 40.0) - 20;
+    }
+
+    if((keys != m_keys) || (rel_mouse_movement != m_rel_mouse_movement))
+    {
+        m_keys = keys;
+        m_rel_mouse_movement = rel_mouse_movement;
+        m_input_changed = true;
+    }
+    m_next_input = current_time + random() * BOT_MAX_INPUT_INTERVAL;
+}
+
+// Send the input to the server when it changes, as the client does
+void Bot::send_input(double current_time, Bot_Stats_t& stats)
+{
+    if(m_input_changed)
+    {
+        sf::Packet packet;
+        sf::Uint8 packet_type = PLAYER_UPDATE;
+        BitWriter writer;
+        writer.write(m_pindex, 8);
+        writer.write(m_keys, KEY_MASK_BITS);
+        writer.writeSigned(m_rel_mouse_movement, NET_MOUSE_BITS);
+        packet << packet_type;
+        writer.appendTo(packet);
+        m_net->sendData(packet);
+        stats.messages_sent++;
+        m_input_changed = false;
+
+        // Only time input that starts a stationary tank moving
+        bool moving = (0u != (m_keys & (KEY_MASK_W | KEY_MASK_S))) || (0 != m_rel_mouse_movement);
+        if(moving && !m_moving)
+        {
+            m_input_time = current_time;
+        }
+        else if(!moving)
+        {
+            m_input_time = 0.0;
+        }
+        m_moving = moving;
+    }
+}
+
+void Bot::fire(double current_time, Bot_Stats_t& stats)
+{
+    sf::Packet packet;
+    sf::Uint8 packet_type = PLAYER_SHOT;
+    BitWriter writer;
+    writer.write(m_pindex, 8);
+    writer.writeQuantized(random() * MAX_SHOT_DISTANCE, 0.0, MAX_SHOT_DISTANCE, NET_SHOT_DISTANCE_BITS);
+    packet << packet_type;
+    writer.appendTo(packet);
+    m_net->sendData(packet, true);
+    stats.messages_sent++;
+    m_shot_allowed = false;
+    m_shot_time = current_time;
+}
@@ -0,0 +1,65 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include <string>
+#include <vector>
+#include "Network.h"
+#include "Snapshot.h"
+#include "refptr.h"
+#include "SFML/Config.hpp"
+
+// Response times and counts gathered by all of the bots
+typedef struct{
+    // Seconds from connecting until the server assigned a player
+    std::vector<double> connect_times;
+    // Seconds from sending new input until the server's snapshots
+    // showed the tank responding to it
+    std::vector<double> input_times;
+    // Seconds from firing until the server announced the shot
+    std::vector<double> shot_times;
+    sf::Uint32 messages_sent;
+    sf::Uint32 messages_received;
+    sf::Uint32 snapshots_received;
+} Bot_Stats_t;
+
+/*
+ * A headless player.  Connects to the server as a normal client would
+ * and plays with random keyboard and mouse input, occasionally firing.
+ */
+class Bot
+{
+    public:
+        Bot(const std::string& name, sf::Uint32 seed);
+        void connect(const sf::IpAddress& host, sf::Uint16 port, const NetSim_Config_t& netsim);
+        void update(double current_time, Bot_Stats_t& stats);
+        void disconnect();
+        bool connected() { return (0u != m_pindex); }
+        Coalesce_Stats_t getCoalesceStats() { return m_net->getCoalesceStats(); }
+    protected:
+        void process_messages(double current_time, Bot_Stats_t& stats);
+        void choose_input(double current_time);
+        void send_input(double current_time, Bot_Stats_t& stats);
+        void fire(double current_time, Bot_Stats_t& stats);
+        double random();
+
+        refptr<Network> m_net;
+        std::string m_name;
+        sf::Uint32 m_rng;
+        sf::Uint8 m_pindex;
+        SnapshotHistory m_snapshots;
+        Snapshot_Player_t m_state;
+        bool m_have_state;
+        sf::Uint32 m_keys;
+        sf::Int32 m_rel_mouse_movement;
+        bool m_input_changed;
+        bool m_moving;
+        double m_next_input;
+        double m_connect_time;
+        // Time unanswered input was sent, zero if there is none
+        double m_input_time;
+        // Time an unannounced shot was fired, zero if there is none
+        double m_shot_time;
+        bool m_shot_allowed;
+};
+
+#endif
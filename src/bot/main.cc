@@ -0,0 +1,146 @@
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include "Bot.h"
+#include "GameParams.h"
+
+// In seconds, how often each bot runs, like a client frame
+#define BOT_FRAME_PERIOD 0.01
+
+// Print the percentiles of a set of response times, in milliseconds
+static void report_times(const char *label, std::vector<double> times)
+{
+    printf("%-16s", label);
+    if(times.empty())
+    {
+        printf(" no samples\n");
+        return;
+    }
+    std::sort(times.begin(), times.end());
+    const double percentiles[] = {0.5, 0.9, 0.99};
+    for(int i = 0; i < 3; i++)
+    {
+        std::size_t ndx = (std::size_t)(percentiles[i] * (times.size() - 1) + 0.5);
+        printf(" p%-2d %8.2f", (int)(percentiles[i] * 100.0), times[ndx] * 1000.0);
+    }
+    printf("  max %8.2f  (%u samples)\n", times.back() * 1000.0, (unsigned int)times.size());
+}
+
+int main(int argc, char *argv[])
+{
+    std::string host = "localhost";
+    int port = DEFAULT_PORT;
+    int num_bots = 10;
+    double duration = 30.0;
+    sf::Uint32 seed = 1u;
+    NetSim_Config_t netsim;
+    NetSim::defaults(netsim);
+
+    for (;;)
+    {
+        static struct option long_options[] = {
+            {"host", required_argument, 0, 'H'},
+            {"port", required_argument, 0, 'p'},
+            {"bots", required_argument, 0, 'n'},
+            {"duration", required_argument, 0, 'd'},
+            {"seed", required_argument, 0, 's'},
+            {"netsim", required_argument, 0, 'N'},
+            {NULL, 0, 0, 0}
+        };
+        int opt_index = 0;
+        int c = getopt_long(argc, argv, "H:p:n:d:s:N:",
+                long_options, &opt_index);
+        if (c == -1)
+            break;
+        switch (c)
+        {
+            case 'H':
+                host = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'n':
+                num_bots = atoi(optarg);
+                break;
+            case 'd':
+                duration = atof(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'N':
+                if (!NetSim::parse(optarg, netsim))
+                {
+                    std::cerr << "Invalid --netsim settings: " << optarg << "\n";
+                    return 1;
+                }
+                break;
+        }
+    }
+
+    Bot_Stats_t stats;
+    stats.messages_sent = 0u;
+    stats.messages_received = 0u;
+    stats.snapshots_received = 0u;
+
+    std::vector< refptr<Bot> > bots;
+    for(int i = 0; i < num_bots; i++)
+    {
+        std::ostringstream name;
+        name << "bot" << i;
+        // Each bot gets its own but repeatable input
+        refptr<Bot> bot = new Bot(name.str(), seed * 7919u + i);
+        NetSim_Config_t bot_netsim = netsim;
+        bot_netsim.seed = netsim.seed + i;
+        bot->connect(sf::IpAddress(host), port, bot_netsim);
+        bots.push_back(bot);
+    }
+
+    sf::Clock clock;
+    double current_time = 0.0;
+    while(current_time < duration)
+    {
+        for(unsigned int i = 0; i < bots.size(); i++)
+        {
+            bots[i]->update(clock.getElapsedTime().asSeconds(), stats);
+        }
+
+        // Sleep out the rest of the frame
+        double next_frame = current_time + BOT_FRAME_PERIOD;
+        current_time = clock.getElapsedTime().asSeconds();
+        if(current_time < next_frame)
+        {
+            sf::sleep(sf::seconds(next_frame - current_time));
+            current_time = clock.getElapsedTime().asSeconds();
+        }
+    }
+
+    int num_connected = 0;
+    sf::Uint32 datagrams_sent = 0u;
+    for(unsigned int i = 0; i < bots.size(); i++)
+    {
+        if(bots[i]->connected())
+        {
+            num_connected++;
+        }
+        datagrams_sent += bots[i]->getCoalesceStats().datagrams_sent;
+        bots[i]->disconnect();
+    }
+
+    printf("%d of %d bots connected over %.1f seconds\n", num_connected, num_bots, current_time);
+    printf("response times (ms):\n");
+    report_times("  connect", stats.connect_times);
+    report_times("  input", stats.input_times);
+    report_times("  shot", stats.shot_times);
+    printf("throughput (per second):\n");
+    printf("  messages sent     %10.1f\n", stats.messages_sent / current_time);
+    printf("  datagrams sent    %10.1f\n", datagrams_sent / current_time);
+    printf("  messages received %10.1f\n", stats.messages_received / current_time);
+    printf("  snapshots         %10.1f\n", stats.snapshots_received / current_time);
+
+    return 0;
+}
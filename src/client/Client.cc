@@ -8,6 +8,7 @@
 #include "Client.h"
 #include "Types.h"
 #include "GameParams.h"
+#include "BitStream.h"
 
 using namespace std;
 
@@ -16,6 +17,8 @@ Client::Client(const string & exe_path)
     m_client_has_focus = true;
     m_exe_path = exe_path;
     m_server_pid = 0;
+    NetSim::defaults(m_netsim);
+    m_io_thread = false;
 }
 
 Client::~Client()
@@ -29,7 +32,13 @@ void Client::connect(int port, const char *host)
     sf::Uint8 packet_type;
     m_net_client = new Network();
     m_net_client->Create(port, host);
+    m_net_client->setNetSim(m_netsim);
+    if(m_io_thread)
+    {
+        m_net_client->startThread();
+    }
     m_players.clear();
+    m_snapshots.clear();
     m_current_player = 0;
     m_left_button_pressed = false;
     m_drawing_shot = false;
@@ -56,6 +65,7 @@ void Client::disconnect()
     // Send disconnect message
     bool connection_closed = false;
     sf::Packet client_packet;
+    PacketView message;
     sf::Uint8 packet_type = PLAYER_DISCONNECT;
     sf::Clock timeout_clock;
     client_packet.clear();
@@ -70,10 +80,10 @@ void Client::disconnect()
     {
         m_net_client->Receive();
 
-        while(m_net_client->getData(client_packet))
+        while(m_net_client->getMessage(message))
         {
             sf::Uint8 packet_type;
-            client_packet >> packet_type;
+            message >> packet_type;
             switch(packet_type)
             {
                 case PLAYER_DISCONNECT:
@@ -81,7 +91,7 @@ void Client::disconnect()
                     sf::Uint8 player_index;
                     // This completely removes the player from the game
                     // Deletes member from the player list
-                    client_packet >> player_index;
+                    message >> player_index;
                     if(player_index == m_current_player)
                     {
                         connection_closed = true;
@@ -108,6 +118,17 @@ void Client::disconnect()
     m_net_client = NULL;
 }
 
+// Counters for the link to the server, false if not connected
+bool Client::get_connection_stats(Connection_Stats_t& stats)
+{
+    if(m_net_client.isNull())
+    {
+        return false;
+    }
+    // The server is the only client of the network, in the first slot
+    return m_net_client->getConnectionStats(NETWORK_CLIENT_ID(0u, 0u), stats);
+}
+
 void Client::run(bool fullscreen, int width, int height, std::string pname)
 {
     m_current_player_name = pname;
@@ -474,14 +495,17 @@ void Client::grab_mouse(bool grab)
 void Client::update(double elapsed_time)
 {
     sf::Packet client_packet;
+    PacketView message;
 
     m_net_client->Receive();
     client_packet.clear();
-    // Handle all received data (only really want the latest)
-    while(m_net_client->getData(client_packet))
+    // Handle all received data.  The players arrive in world snapshots,
+    // deltas against the last one acknowledged, all on the one sequenced
+    // SNAPSHOT_CHANNEL, so only the latest snapshot is seen.
+    while(m_net_client->getMessage(message))
     {
         sf::Uint8 packet_type;
-        client_packet >> packet_type;
+        message >> packet_type;
         switch(packet_type)
         {
             case PLAYER_CONNECT:
@@ -489,9 +513,9 @@ void Client::update(double elapsed_time)
                 sf::Uint16 players_port = sf::Socket::AnyPort;
                 sf::Uint8 pindex;
                 std::string name = "";
-                client_packet >> pindex;
-                client_packet >> name;
-                client_packet >> players_port;
+                message >> pindex;
+                message >> name;
+                message >> players_port;
                 // Should be a much better way of doing this.
                 // Perhaps generate a random number
                 if((name == m_current_player_name) &&
@@ -505,24 +529,39 @@ void Client::update(double elapsed_time)
                 {
                     refptr<Player> p = new Player();
                     p->name = name;
-                    client_packet >> p->direction;
-                    client_packet >> p->x;
-                    client_packet >> p->y;
+                    message >> p->direction;
+                    message >> p->x;
+                    message >> p->y;
                     m_players[pindex] = p;
                 }
                 break;
             }
-            case PLAYER_UPDATE:
+            case WORLD_SNAPSHOT:
             {
-                sf::Uint8 player_index;
-                // Update player position as calculated from the server.
-                client_packet >> player_index;
-                if(m_players.end() != m_players.find(player_index))
+                // Update player positions as calculated from the server.
+                // The snapshot is a delta against one we acknowledged.
+                BitReader reader(message.getData() + 1, message.getDataSize() - 1);
+                Snapshot snapshot;
+                if(snapshot.decode(reader, m_snapshots))
                 {
-                    client_packet >> m_players[player_index]->direction;
-                    client_packet >> m_players[player_index]->x;
-                    client_packet >> m_players[player_index]->y;
-                    client_packet >> m_players[player_index]->hover;
+                    m_snapshots.store(snapshot);
+                    for(std::map<sf::Uint8, Snapshot_Player_t>::iterator iter = snapshot.players.begin();
+                        iter != snapshot.players.end(); iter++)
+                    {
+                        if(m_players.end() != m_players.find(iter->first))
+                        {
+                            refptr<Player> player = m_players[iter->first];
+                            snapshot.getPlayer(iter->first, player->direction,
+                                               player->x, player->y, player->hover);
+                        }
+                    }
+
+                    sf::Packet ack_packet;
+                    sf::Uint8 ack_type = SNAPSHOT_ACK;
+                    ack_packet << ack_type;
+                    ack_packet << m_current_player;
+                    ack_packet << snapshot.id;
+                    m_net_client->sendData(ack_packet);
                 }
                 break;
             }
@@ -531,7 +570,7 @@ void Client::update(double elapsed_time)
                 sf::Uint8 player_index;
                 // This completely removes the player from the game
                 // Deletes member from the player list
-                client_packet >> player_index;
+                message >> player_index;
                 m_players.erase(player_index);
                 break;
             }
@@ -541,7 +580,7 @@ void Client::update(double elapsed_time)
                 sf::Uint8 player_index;
                 // This completely removes the player from the game
                 // Deletes member from the player list
-                client_packet >> player_index;
+                message >> player_index;
                 if(m_players.end() != m_players.find(player_index))
                 {
                     m_players[player_index]->m_is_dead = true;
@@ -551,19 +590,16 @@ void Client::update(double elapsed_time)
 
             case PLAYER_SHOT:
             {
-                sf::Uint8 pindex;
-                double x,y;
-                double direction;
-                double distance;
-
-                client_packet >> pindex;
-                client_packet >> x;
-                client_packet >> y;
-                client_packet >> direction;
-                client_packet >> distance;
+                BitReader reader(message.getData() + 1, message.getDataSize() - 1);
+                sf::Uint8 pindex = reader.read(8);
+                double x = reader.readQuantized(NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+                double y = reader.readQuantized(NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+                double direction = reader.readAngle(NET_ANGLE_BITS);
+                double distance = reader.readQuantized(0.0, MAX_SHOT_DISTANCE, NET_SHOT_DISTANCE_BITS);
 
                 // Ensure that the player who shot exists
-                if(m_players.end() != m_players.find(pindex))
+                if((!reader.overflowed()) &&
+                   (m_players.end() != m_players.find(pindex)))
                 {
                     // Perhaps sometime in the future, the shots will
                     // be different colors depending on the player
@@ -581,9 +617,9 @@ void Client::update(double elapsed_time)
                 float x;
                 float y;
                 sf::Uint8 pindex;
-                client_packet >> x;
-                client_packet >> y;
-                client_packet >> pindex;
+                message >> x;
+                message >> y;
+                message >> pindex;
                 // Damage the tile if it exists
                 if((!m_map.get_tile_at(x, y).isNull()))
                 {
@@ -676,14 +712,18 @@ void Client::update(double elapsed_time)
            (player->rel_mouse_movement !=  rel_mouse_movement))
         {
             sf::Uint8 packet_type = PLAYER_UPDATE;
+            sf::Uint32 keys = 0u;
+            keys |= (KEY_PRESSED == w_pressed) ? KEY_MASK_W : 0u;
+            keys |= (KEY_PRESSED == a_pressed) ? KEY_MASK_A : 0u;
+            keys |= (KEY_PRESSED == s_pressed) ? KEY_MASK_S : 0u;
+            keys |= (KEY_PRESSED == d_pressed) ? KEY_MASK_D : 0u;
+            BitWriter writer;
+            writer.write(m_current_player, 8);
+            writer.write(keys, KEY_MASK_BITS);
+            writer.writeSigned(rel_mouse_movement, NET_MOUSE_BITS);
             client_packet.clear();
             client_packet << packet_type;
-            client_packet << m_current_player;
-            client_packet << w_pressed;
-            client_packet << a_pressed;
-            client_packet << s_pressed;
-            client_packet << d_pressed;
-            client_packet << rel_mouse_movement;
+            writer.appendTo(client_packet);
 
             m_net_client->sendData(client_packet);
 
@@ -704,10 +744,12 @@ void Client::create_shot()
     sf::Packet client_packet;
     double shot_distance = m_drawing_shot_distance + SHOT_RING_WIDTH / 2.0;
     sf::Uint8 packet_type = PLAYER_SHOT;
+    BitWriter writer;
+    writer.write(m_current_player, 8);
+    writer.writeQuantized(shot_distance, 0.0, MAX_SHOT_DISTANCE, NET_SHOT_DISTANCE_BITS);
     client_packet.clear();
     client_packet << packet_type;
-    client_packet << m_current_player;
-    client_packet << shot_distance;
+    writer.appendTo(client_packet);
     m_net_client->sendData(client_packet, true);
     m_drawing_shot_distance = 0;
     m_players[m_current_player]->m_shot_allowed = false;
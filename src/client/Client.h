@@ -15,6 +15,7 @@
 #include "GLMatrix.h"
 #include "GLBuffer.h"
 #include "Network.h"
+#include "Snapshot.h"
 #include <SFGUI/SFGUI.hpp>
 
 enum
@@ -39,6 +40,10 @@ class Client
         Client(const std::string & exe_path);
         ~Client();
         void run(bool fullscreen, int width, int height, std::string pname);
+        void set_netsim(const NetSim_Config_t& config) { m_netsim = config; }
+        // Do the socket work on a thread of its own, see Network::startThread()
+        void set_io_thread(bool io_thread) { m_io_thread = io_thread; }
+        bool get_connection_stats(Connection_Stats_t& stats);
     protected:
         void run_main_menu();
         void run_host_menu();
@@ -85,6 +90,8 @@ class Client
         sf::Uint8 m_current_player;
         std::string m_current_player_name;
         std::map<sf::Uint8, refptr<Player> > m_players;
+        // World snapshots received from the server
+        SnapshotHistory m_snapshots;
         int m_width;
         int m_height;
         GLProgram m_obj_program;
@@ -108,6 +115,9 @@ class Client
         GLBuffer m_sphere_attributes;
         GLBuffer m_sphere_indices;
         refptr<Network> m_net_client;
+        // Simulated network conditions for the connection to the server
+        NetSim_Config_t m_netsim;
+        bool m_io_thread;
         bool m_client_has_focus;
         sf::Texture m_lava_texture;
         bool m_left_button_pressed;
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <getopt.h>
+#include <iostream>
 #include "Client.h"
 
 int main(int argc, char *argv[])
@@ -8,12 +9,17 @@ int main(int argc, char *argv[])
     int width = 1200;
     int height = 900;
     std::string player_name = "Player";
+    NetSim_Config_t netsim;
+    NetSim::defaults(netsim);
+    bool io_thread = false;
 
     struct option longopts[] = {
         {"fullscreen", no_argument, NULL, 'f'},
         {"height", required_argument, NULL, 'h'},
         {"width", required_argument, NULL, 'w'},
         {"name", required_argument, NULL, 'n'},
+        {"netsim", required_argument, NULL, 's'},
+        {"io-thread", no_argument, NULL, 't'},
         {NULL, 0, NULL, 0}
     };
     for (;;)
@@ -35,10 +41,22 @@ int main(int argc, char *argv[])
             case 'n':
                 player_name = std::string(optarg);
                 break;
+            case 't':
+                io_thread = true;
+                break;
+            case 's':
+                if (!NetSim::parse(optarg, netsim))
+                {
+                    std::cerr << "Invalid --netsim settings: " << optarg << "\n";
+                    return 1;
+                }
+                break;
         }
     }
 
     Client client(argv[0]);
+    client.set_netsim(netsim);
+    client.set_io_thread(io_thread);
 
     client.run(fullscreen, width, height, player_name);
 
@@ -0,0 +1,171 @@
+#include <math.h>
+#include "BitStream.h"
+
+// Largest value that fits in the given number of bits (1 to 32)
+static sf::Uint32 maxValue(unsigned int bits)
+{
+    return (bits >= 32u) ? 0xFFFFFFFFu : (((sf::Uint32)1u << bits) - 1u);
+}
+
+BitWriter::BitWriter()
+{
+    clear();
+}
+
+void BitWriter::write(sf::Uint32 value, unsigned int bits)
+{
+    value &= maxValue(bits);
+    // Move whole bytes out of the scratch word as they fill up
+    while(bits > 0u)
+    {
+        unsigned int count = 8u - m_scratch_bits;
+        if(count > bits)
+        {
+            count = bits;
+        }
+        bits -= count;
+        m_scratch = (m_scratch << count) | ((value >> bits) & maxValue(count));
+        m_scratch_bits += count;
+        if(8u == m_scratch_bits)
+        {
+            m_bytes.push_back((sf::Uint8)m_scratch);
+            m_scratch = 0u;
+            m_scratch_bits = 0u;
+        }
+    }
+}
+
+// Values outside the range of the bit count are clamped
+void BitWriter::writeSigned(sf::Int32 value, unsigned int bits)
+{
+    sf::Int32 limit = (sf::Int32)maxValue(bits - 1u);
+    if(value > limit)
+    {
+        value = limit;
+    }
+    else if(value < -limit)
+    {
+        value = -limit;
+    }
+    write((sf::Uint32)value + (sf::Uint32)limit, bits);
+}
+
+void BitWriter::writeQuantized(double value, double min, double max, unsigned int bits)
+{
+    write(quantize(value, min, max, bits), bits);
+}
+
+void BitWriter::writeAngle(double angle, unsigned int bits)
+{
+    write(quantizeAngle(angle, bits), bits);
+}
+
+// Values outside the range are clamped
+sf::Uint32 BitWriter::quantize(double value, double min, double max, unsigned int bits)
+{
+    sf::Uint32 steps = maxValue(bits);
+    sf::Uint32 quantized;
+    if(value <= min)
+    {
+        quantized = 0u;
+    }
+    else if(value >= max)
+    {
+        quantized = steps;
+    }
+    else
+    {
+        quantized = (sf::Uint32)floor((value - min) / (max - min) * steps + 0.5);
+    }
+    return quantized;
+}
+
+// Any angle in radians, it is wrapped into [0, 2 * PI)
+sf::Uint32 BitWriter::quantizeAngle(double angle, unsigned int bits)
+{
+    double turns = angle / (2.0 * M_PI);
+    turns -= floor(turns);
+    // A full turn wraps back round to zero
+    return (sf::Uint32)floor(turns * ((double)maxValue(bits) + 1.0) + 0.5) & maxValue(bits);
+}
+
+void BitWriter::appendTo(sf::Packet& p)
+{
+    if(!m_bytes.empty())
+    {
+        p.append(&m_bytes[0], m_bytes.size());
+    }
+    if(m_scratch_bits > 0u)
+    {
+        sf::Uint8 last = (sf::Uint8)(m_scratch << (8u - m_scratch_bits));
+        p.append(&last, 1u);
+    }
+}
+
+void BitWriter::clear()
+{
+    m_bytes.clear();
+    m_scratch = 0u;
+    m_scratch_bits = 0u;
+}
+
+BitReader::BitReader(const void* data, std::size_t size)
+{
+    m_data = (const sf::Uint8*)data;
+    m_size = size;
+    m_bit_pos = 0u;
+    m_overflowed = false;
+}
+
+sf::Uint32 BitReader::read(unsigned int bits)
+{
+    sf::Uint32 value = 0u;
+    while(bits > 0u)
+    {
+        std::size_t byte = m_bit_pos >> 3;
+        unsigned int offset = m_bit_pos & 7u;
+        unsigned int count = 8u - offset;
+        if(count > bits)
+        {
+            count = bits;
+        }
+        sf::Uint32 chunk = 0u;
+        if(byte < m_size)
+        {
+            chunk = (m_data[byte] >> (8u - offset - count)) & maxValue(count);
+        }
+        else
+        {
+            m_overflowed = true;
+        }
+        value = (value << count) | chunk;
+        m_bit_pos += count;
+        bits -= count;
+    }
+    return value;
+}
+
+sf::Int32 BitReader::readSigned(unsigned int bits)
+{
+    return (sf::Int32)read(bits) - (sf::Int32)maxValue(bits - 1u);
+}
+
+double BitReader::readQuantized(double min, double max, unsigned int bits)
+{
+    return dequantize(read(bits), min, max, bits);
+}
+
+double BitReader::readAngle(unsigned int bits)
+{
+    return dequantizeAngle(read(bits), bits);
+}
+
+double BitReader::dequantize(sf::Uint32 value, double min, double max, unsigned int bits)
+{
+    return min + (max - min) * value / maxValue(bits);
+}
+
+double BitReader::dequantizeAngle(sf::Uint32 value, unsigned int bits)
+{
+    return 2.0 * M_PI * value / ((double)maxValue(bits) + 1.0);
+}
@@ -0,0 +1,64 @@
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <vector>
+#include <cstddef>
+#include <SFML/Config.hpp>
+#include <SFML/Network.hpp>
+
+/*
+ * Packs values into a buffer using only as many bits as each one needs.
+ * Values are written most significant bit first, and the last byte is
+ * padded with zero bits when the stream is added to a packet.
+ *
+ * Floating point values are quantized to a fixed number of steps over
+ * a known range, so the precision sent is chosen per value.
+ */
+class BitWriter
+{
+    public:
+        BitWriter();
+        void write(sf::Uint32 value, unsigned int bits);
+        void writeBool(bool value) { write(value ? 1u : 0u, 1u); }
+        void writeSigned(sf::Int32 value, unsigned int bits);
+        void writeQuantized(double value, double min, double max, unsigned int bits);
+        void writeAngle(double angle, unsigned int bits);
+        // The integer that writeQuantized()/writeAngle() would write
+        static sf::Uint32 quantize(double value, double min, double max, unsigned int bits);
+        static sf::Uint32 quantizeAngle(double angle, unsigned int bits);
+        // Number of bits written so far
+        std::size_t getBitCount() { return m_bytes.size() * 8u + m_scratch_bits; }
+        void appendTo(sf::Packet& p);
+        void clear();
+    protected:
+        std::vector<sf::Uint8> m_bytes;
+        sf::Uint32 m_scratch;
+        unsigned int m_scratch_bits;
+};
+
+/*
+ * Reads back values written by a BitWriter.  Reading past the end of
+ * the data returns zero bits and sets the overflowed flag, so a short
+ * message can be detected once everything has been read.
+ */
+class BitReader
+{
+    public:
+        BitReader(const void* data, std::size_t size);
+        sf::Uint32 read(unsigned int bits);
+        bool readBool() { return (0u != read(1u)); }
+        sf::Int32 readSigned(unsigned int bits);
+        double readQuantized(double min, double max, unsigned int bits);
+        double readAngle(unsigned int bits);
+        // The value represented by a quantized integer
+        static double dequantize(sf::Uint32 value, double min, double max, unsigned int bits);
+        static double dequantizeAngle(sf::Uint32 value, unsigned int bits);
+        bool overflowed() { return m_overflowed; }
+    protected:
+        const sf::Uint8* m_data;
+        std::size_t m_size;
+        std::size_t m_bit_pos;
+        bool m_overflowed;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "EndpointMap.h"
+
+// Initial number of slots, must be a power of two
+#define ENDPOINT_MAP_INITIAL_SIZE 32
+
+EndpointMap::EndpointMap()
+{
+    clear();
+}
+
+sf::Uint64 EndpointMap::makeKey(const sf::IpAddress& addr, unsigned short port)
+{
+    return ((sf::Uint64)addr.toInteger() << 16) | port;
+}
+
+// Find the slot holding the key, or the empty slot where it belongs
+unsigned int EndpointMap::slotFor(sf::Uint64 key)
+{
+    unsigned int mask = m_entries.size() - 1;
+    // Fibonacci hashing spreads neighbouring ports over the table
+    unsigned int ndx = (unsigned int)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    while(m_entries[ndx].in_use && (m_entries[ndx].key != key))
+    {
+        ndx = (ndx + 1) & mask;
+    }
+    return ndx;
+}
+
+sf::Uint16 EndpointMap::find(const sf::IpAddress& addr, unsigned short port)
+{
+    unsigned int ndx = slotFor(makeKey(addr, port));
+    return m_entries[ndx].in_use ? m_entries[ndx].handle : ENDPOINT_NOT_FOUND;
+}
+
+void EndpointMap::insert(const sf::IpAddress& addr, unsigned short port, sf::Uint16 handle)
+{
+    // Keep the table at most half full so probe sequences stay short
+    if((m_count + 1) * 2 > m_entries.size())
+    {
+        grow();
+    }
+    sf::Uint64 key = makeKey(addr, port);
+    unsigned int ndx = slotFor(key);
+    if(!m_entries[ndx].in_use)
+    {
+        m_count++;
+    }
+    m_entries[ndx].key = key;
+    m_entries[ndx].handle = handle;
+    m_entries[ndx].in_use = true;
+}
+
+void EndpointMap::erase(const sf::IpAddress& addr, unsigned short port)
+{
+    unsigned int mask = m_entries.size() - 1;
+    unsigned int ndx = slotFor(makeKey(addr, port));
+    if(!m_entries[ndx].in_use)
+    {
+        return;
+    }
+    m_entries[ndx].in_use = false;
+    m_count--;
+
+    // Shift back any following entries that would no longer be found
+    // past the hole that was just made.
+    unsigned int next = (ndx + 1) & mask;
+    while(m_entries[next].in_use)
+    {
+        Endpoint_Entry_t entry = m_entries[next];
+        m_entries[next].in_use = false;
+        m_entries[slotFor(entry.key)] = entry;
+        next = (next + 1) & mask;
+    }
+}
+
+void EndpointMap::clear()
+{
+    Endpoint_Entry_t empty;
+    empty.key = 0u;
+    empty.handle = 0u;
+    empty.in_use = false;
+    m_entries.assign(ENDPOINT_MAP_INITIAL_SIZE, empty);
+    m_count = 0u;
+}
+
+void EndpointMap::grow()
+{
+    std::vector<Endpoint_Entry_t> old_entries = m_entries;
+    Endpoint_Entry_t empty;
+    empty.key = 0u;
+    empty.handle = 0u;
+    empty.in_use = false;
+    m_entries.assign(old_entries.size() * 2, empty);
+    for(unsigned int i = 0; i < old_entries.size(); i++)
+    {
+        if(old_entries[i].in_use)
+        {
+            m_entries[slotFor(old_entries[i].key)] = old_entries[i];
+        }
+    }
+}
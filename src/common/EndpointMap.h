@@ -0,0 +1,39 @@
+#ifndef ENDPOINTMAP_H
+#define ENDPOINTMAP_H
+
+#include <vector>
+#include <SFML/Config.hpp>
+#include <SFML/Network.hpp>
+
+// Returned by EndpointMap::find() when the endpoint is not present
+#define ENDPOINT_NOT_FOUND 0xFFFFu
+
+/*
+ * Hash table from a remote (address, port) pair to a client handle.
+ * Uses open addressing with linear probing, so a lookup is a hash and
+ * usually a single compare no matter how many clients are connected.
+ */
+class EndpointMap
+{
+    public:
+        EndpointMap();
+        sf::Uint16 find(const sf::IpAddress& addr, unsigned short port);
+        void insert(const sf::IpAddress& addr, unsigned short port, sf::Uint16 handle);
+        void erase(const sf::IpAddress& addr, unsigned short port);
+        void clear();
+    protected:
+        typedef struct{
+            sf::Uint64 key;
+            sf::Uint16 handle;
+            bool in_use;
+        } Endpoint_Entry_t;
+
+        static sf::Uint64 makeKey(const sf::IpAddress& addr, unsigned short port);
+        unsigned int slotFor(sf::Uint64 key);
+        void grow();
+
+        std::vector<Endpoint_Entry_t> m_entries;
+        unsigned int m_count;
+};
+
+#endif
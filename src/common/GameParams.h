@@ -6,4 +6,15 @@
 #define SHOT_EXPAND_SPEED 75.0
 #define SHOT_RING_WIDTH 10.0f
 
+// Range and precision of the quantized values in game messages.
+// Coordinates cover the map with room for a player that has hovered
+// off the edge, to about 0.03 units.
+#define NET_COORD_MIN (-1024.0)
+#define NET_COORD_MAX 1024.0
+#define NET_COORD_BITS 16
+#define NET_ANGLE_BITS 12
+#define NET_HOVER_BITS 8
+#define NET_SHOT_DISTANCE_BITS 12
+#define NET_MOUSE_BITS 16
+
 #endif
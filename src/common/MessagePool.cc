@@ -0,0 +1,76 @@
+#include "MessagePool.h"
+
+MessagePool::MessagePool(std::size_t buffer_size)
+{
+    m_buffer_size = buffer_size;
+    m_allocations = 0u;
+}
+
+MessagePool::~MessagePool()
+{
+    for(unsigned int i = 0; i < m_buffers.size(); i++)
+    {
+        delete m_buffers[i];
+    }
+}
+
+sf::Uint32 MessagePool::acquire(std::size_t size)
+{
+    if(m_free.empty())
+    {
+        grow();
+    }
+    sf::Uint32 handle = m_free.back();
+    m_free.pop_back();
+
+    Message_Buffer_t* buffer = m_buffers[handle];
+    if(size > buffer->data.size())
+    {
+        // Only a message too big for a datagram, before it is split up
+        // or once it has been put back together, gets here.
+        buffer->data.resize(size);
+        m_allocations++;
+    }
+    buffer->size = size;
+    buffer->refs = 1u;
+    return handle;
+}
+
+void MessagePool::release(sf::Uint32 handle)
+{
+    Message_Buffer_t* buffer = m_buffers[handle];
+    if((buffer->refs > 0u) && (0u == --buffer->refs))
+    {
+        m_free.push_back(handle);
+    }
+}
+
+void MessagePool::clear()
+{
+    m_free.clear();
+    for(unsigned int i = m_buffers.size(); i > 0u; i--)
+    {
+        m_buffers[i - 1u]->refs = 0u;
+        m_free.push_back(i - 1u);
+    }
+}
+
+void MessagePool::grow()
+{
+    unsigned int first = m_buffers.size();
+    m_buffers.reserve(first + MESSAGE_POOL_GROWTH);
+    m_free.reserve(first + MESSAGE_POOL_GROWTH);
+    for(unsigned int i = first + MESSAGE_POOL_GROWTH; i > first; i--)
+    {
+        m_free.push_back(i - 1u);
+    }
+    for(unsigned int i = 0; i < MESSAGE_POOL_GROWTH; i++)
+    {
+        Message_Buffer_t* buffer = new Message_Buffer_t();
+        buffer->data.resize(m_buffer_size);
+        buffer->size = 0u;
+        buffer->refs = 0u;
+        m_buffers.push_back(buffer);
+        m_allocations++;
+    }
+}
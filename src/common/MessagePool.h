@@ -0,0 +1,53 @@
+#ifndef MESSAGEPOOL_H
+#define MESSAGEPOOL_H
+
+#include <vector>
+#include <cstddef>
+#include <SFML/Config.hpp>
+
+// Handle that refers to no message
+#define MESSAGE_NONE 0xFFFFFFFFu
+
+// Number of buffers added each time the pool runs out
+#define MESSAGE_POOL_GROWTH 256
+
+/*
+ * Reference counted message buffers that are reused instead of freed.
+ * A message is copied into a buffer once when it is queued, and every
+ * client it goes to holds a reference to that one copy.  Buffers start
+ * out big enough for any message that fits in a datagram, so once the
+ * pool has grown to the amount of traffic no more memory is allocated.
+ * getAllocations() counts every time the pool did have to allocate.
+ */
+class MessagePool
+{
+    public:
+        MessagePool(std::size_t buffer_size);
+        ~MessagePool();
+        // Returns a buffer of the given size with one reference to it
+        sf::Uint32 acquire(std::size_t size);
+        char *getData(sf::Uint32 handle) { return &m_buffers[handle]->data[0]; }
+        std::size_t getSize(sf::Uint32 handle) { return m_buffers[handle]->size; }
+        void addRef(sf::Uint32 handle) { m_buffers[handle]->refs++; }
+        void release(sf::Uint32 handle);
+        // Take back every buffer, whoever holds it
+        void clear();
+        sf::Uint32 getAllocations() { return m_allocations; }
+        sf::Uint32 getInUse() { return m_buffers.size() - m_free.size(); }
+    protected:
+        typedef struct{
+            std::vector<char> data;
+            std::size_t size;
+            sf::Uint32 refs;
+        } Message_Buffer_t;
+
+        void grow();
+
+        std::size_t m_buffer_size;
+        // Buffers are allocated one by one so their addresses never change
+        std::vector<Message_Buffer_t*> m_buffers;
+        std::vector<sf::Uint32> m_free;
+        sf::Uint32 m_allocations;
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include "NetCapture.h"
+
+// Longest datagram a record may hold
+#define NETCAPTURE_MAX_LENGTH 65536u
+
+NetCapture::NetCapture()
+{
+    m_file = NULL;
+    m_writing = false;
+    m_port = 0;
+    m_last_time = 0u;
+}
+
+NetCapture::~NetCapture()
+{
+    close();
+}
+
+bool NetCapture::create(const char *filename, unsigned short port)
+{
+    close();
+    m_file = fopen(filename, "wb");
+    if(NULL == m_file)
+    {
+        return false;
+    }
+    m_writing = true;
+    m_port = port;
+    m_last_time = 0u;
+    writeUint(NETCAPTURE_MAGIC, 4);
+    writeUint(NETCAPTURE_VERSION, 2);
+    writeUint(port, 2);
+    return true;
+}
+
+bool NetCapture::open(const char *filename)
+{
+    close();
+    m_file = fopen(filename, "rb");
+    if(NULL == m_file)
+    {
+        return false;
+    }
+    m_writing = false;
+    m_last_time = 0u;
+    sf::Uint32 magic = 0u;
+    sf::Uint32 version = 0u;
+    sf::Uint32 port = 0u;
+    if((!readUint(magic, 4)) || (NETCAPTURE_MAGIC != magic) ||
+       (!readUint(version, 2)) || (NETCAPTURE_VERSION != version) ||
+       (!readUint(port, 2)))
+    {
+        close();
+        return false;
+    }
+    m_port = port;
+    return true;
+}
+
+void NetCapture::close()
+{
+    if(NULL != m_file)
+    {
+        fclose(m_file);
+        m_file = NULL;
+    }
+}
+
+void NetCapture::record(sf::Uint8 direction, double time, const char *data, std::size_t size,
+                        const sf::IpAddress& addr, unsigned short port)
+{
+    if((NULL == m_file) || (!m_writing))
+    {
+        return;
+    }
+    sf::Uint64 now = (time > 0.0) ? (sf::Uint64)(time * 1000000.0) : 0u;
+    if(now < m_last_time)
+    {
+        now = m_last_time;
+    }
+    sf::Uint64 delta = now - m_last_time;
+    if(delta > 0xFFFFFFFFu)
+    {
+        delta = 0xFFFFFFFFu;
+    }
+    m_last_time += delta;
+
+    fputc(direction, m_file);
+    writeVarint((sf::Uint32)delta);
+    writeUint(addr.toInteger(), 4);
+    writeUint(port, 2);
+    writeVarint(size);
+    fwrite(data, 1, size, m_file);
+}
+
+// Push what has been recorded out to the file, so a server that is
+// killed loses at most the records since the last flush.
+void NetCapture::flush()
+{
+    if((NULL != m_file) && m_writing)
+    {
+        fflush(m_file);
+    }
+}
+
+// Read the next record, false at the end of the file
+bool NetCapture::read(NetCapture_Record_t& record)
+{
+    if((NULL == m_file) || m_writing)
+    {
+        return false;
+    }
+    int direction = fgetc(m_file);
+    sf::Uint32 delta = 0u;
+    sf::Uint32 addr = 0u;
+    sf::Uint32 port = 0u;
+    sf::Uint32 length = 0u;
+    if((EOF == direction) || (!readVarint(delta)) || (!readUint(addr, 4)) ||
+       (!readUint(port, 2)) || (!readVarint(length)) || (length > NETCAPTURE_MAX_LENGTH))
+    {
+        return false;
+    }
+    record.data.resize(length);
+    if((length > 0u) && (fread(&record.data[0], 1, length, m_file) != length))
+    {
+        // Cut short, as it would be if the server was killed
+        return false;
+    }
+    m_last_time += delta;
+    record.direction = (sf::Uint8)direction;
+    record.time = m_last_time / 1000000.0;
+    record.addr = sf::IpAddress(addr);
+    record.port = (unsigned short)port;
+    return true;
+}
+
+void NetCapture::writeUint(sf::Uint32 value, int bytes)
+{
+    for(int i = bytes - 1; i >= 0; i--)
+    {
+        fputc((int)((value >> (i * 8)) & 0xFFu), m_file);
+    }
+}
+
+bool NetCapture::readUint(sf::Uint32& value, int bytes)
+{
+    value = 0u;
+    for(int i = 0; i < bytes; i++)
+    {
+        int c = fgetc(m_file);
+        if(EOF == c)
+        {
+            return false;
+        }
+        value = (value << 8) | (sf::Uint32)c;
+    }
+    return true;
+}
+
+void NetCapture::writeVarint(sf::Uint32 value)
+{
+    while(value >= 0x80u)
+    {
+        fputc((int)((value & 0x7Fu) | 0x80u), m_file);
+        value >>= 7;
+    }
+    fputc((int)value, m_file);
+}
+
+bool NetCapture::readVarint(sf::Uint32& value)
+{
+    value = 0u;
+    for(int shift = 0; shift < 35; shift += 7)
+    {
+        int c = fgetc(m_file);
+        if(EOF == c)
+        {
+            return false;
+        }
+        value |= (sf::Uint32)(c & 0x7F) << shift;
+        if(0 == (c & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,75 @@
+#ifndef NETCAPTURE_H
+#define NETCAPTURE_H
+
+#include <cstdio>
+#include <vector>
+#include <SFML/Config.hpp>
+#include <SFML/Network.hpp>
+
+// First bytes of every capture file, "TTCP"
+#define NETCAPTURE_MAGIC 0x54544350u
+// Goes up with NETHEADER_VERSION too, since the datagrams in a capture
+// can only be replayed by a build that reads the same format
+#define NETCAPTURE_VERSION 3
+
+// Direction of a captured datagram
+#define NETCAPTURE_RECEIVED 0u
+#define NETCAPTURE_SENT 1u
+
+typedef struct{
+    sf::Uint8 direction;
+    // Seconds since the capture was started
+    double time;
+    sf::IpAddress addr;
+    unsigned short port;
+    std::vector<char> data;
+} NetCapture_Record_t;
+
+/*
+ * File of every datagram a Network sent and received, with the time
+ * it happened, so that real traffic can be fed back in later.  The
+ * file starts with:
+ *   Uint32 NETCAPTURE_MAGIC
+ *   Uint16 NETCAPTURE_VERSION
+ *   Uint16 local port
+ * followed by one record per datagram:
+ *   Uint8  direction
+ *   varint microseconds since the previous record
+ *   Uint32 remote address
+ *   Uint16 remote port
+ *   varint length
+ *   data
+ * Fixed size numbers are big endian.  A varint holds 7 bits per byte,
+ * lowest bits first, with the top bit set on every byte but the last.
+ *
+ * Nothing the server keeps secret goes in the file, so a capture can be
+ * handed around without letting anyone forge cookies or checks.
+ */
+class NetCapture
+{
+    public:
+        NetCapture();
+        ~NetCapture();
+        bool create(const char *filename, unsigned short port);
+        bool open(const char *filename);
+        void close();
+        bool isOpen() { return NULL != m_file; }
+        void record(sf::Uint8 direction, double time, const char *data, std::size_t size,
+                    const sf::IpAddress& addr, unsigned short port);
+        void flush();
+        bool read(NetCapture_Record_t& record);
+        unsigned short getPort() { return m_port; }
+    protected:
+        void writeUint(sf::Uint32 value, int bytes);
+        bool readUint(sf::Uint32& value, int bytes);
+        void writeVarint(sf::Uint32 value);
+        bool readVarint(sf::Uint32& value);
+
+        FILE *m_file;
+        bool m_writing;
+        unsigned short m_port;
+        // Time of the last record, in microseconds
+        sf::Uint64 m_last_time;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include "NetCompress.h"
+#include <cstring>
+
+/*
+ * Byte strings that turn up in many of our messages, taken from the
+ * reliable traffic of a bot match: player list entries with their
+ * sf::Packet string lengths, zeroed positions, and the player update
+ * and death messages.  Changing it breaks compatibility, so it may only
+ * ever be added to at the front, where matches that reach back from
+ * the end of it will not see the difference.
+ */
+static const char dictionary[] =
+    "\x1a\x01\x00\x00\x00\x06Player\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x1a\x02\x00\x00\x00\x05" "bot10\x83\xa3\x18\x2d\x44\x54\xfb\x21\xf9\x3f"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x1a\x03\x00\x00\x00\x04" "bot1\x00\x00\x18\x2d\x44\x54\xfb\x21\x09\x40"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x2b\x01\x2b\x02\x3c\x01\x3c\x02\x4d\x01\x5e\x01\xa1\x00\x00\x00\x00"
+    "\x1a\x04\x00\x00\x00\x06Player\x00\x00\x18\x2d\x44\x54\xfb\x21\xf9\xbf";
+#define DICTIONARY_SIZE (sizeof(dictionary) - 1u)
+
+static bool readVarint(const sf::Uint8 *in, std::size_t size, std::size_t& ip, std::size_t& value)
+{
+    value = 0u;
+    for(int shift = 0; (shift < 35) && (ip < size); shift += 7)
+    {
+        sf::Uint8 c = in[ip++];
+        value |= (std::size_t)(c & 0x7Fu) << shift;
+        if(0u == (c & 0x80u))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Add the bytes that extend a length past the 15 in a token
+static bool readLength(const sf::Uint8 *in, std::size_t size, std::size_t& ip, std::size_t& length)
+{
+    sf::Uint8 c;
+    do
+    {
+        if(ip >= size)
+        {
+            return false;
+        }
+        c = in[ip++];
+        length += c;
+    } while(255u == c);
+    return true;
+}
+
+NetCompress::NetCompress()
+    : m_table(NETCOMPRESS_HASH_SIZE, 0u)
+{
+    // Hashing the dictionary once means each payload starts from a
+    // copy of the table rather than hashing it all again.
+    const sf::Uint8 *bytes = (const sf::Uint8 *)dictionary;
+    for(std::size_t pos = 0u; (pos + NETCOMPRESS_MIN_MATCH) <= DICTIONARY_SIZE; pos++)
+    {
+        m_table[hash(&bytes[pos])] = pos + 1u;
+    }
+    m_dictionary_table = m_table;
+    m_window.assign(bytes, bytes + DICTIONARY_SIZE);
+}
+
+sf::Uint32 NetCompress::hash(const sf::Uint8 *bytes)
+{
+    sf::Uint32 value = (sf::Uint32)bytes[0] | ((sf::Uint32)bytes[1] << 8) |
+                       ((sf::Uint32)bytes[2] << 16) | ((sf::Uint32)bytes[3] << 24);
+    return (value * 2654435761u) >> (32 - NETCOMPRESS_HASH_BITS);
+}
+
+void NetCompress::writeLength(std::vector<char>& out, std::size_t length)
+{
+    while(length >= 255u)
+    {
+        out.push_back((char)255);
+        length -= 255u;
+    }
+    out.push_back((char)length);
+}
+
+std::size_t NetCompress::compress(const char *data, std::size_t size, std::vector<char>& out)
+{
+    out.clear();
+    // The window keeps the dictionary at its start between calls
+    m_window.resize(DICTIONARY_SIZE + size);
+    if(size > 0u)
+    {
+        memcpy(&m_window[DICTIONARY_SIZE], data, size);
+    }
+    m_table = m_dictionary_table;
+
+    std::size_t value = size;
+    while(value >= 0x80u)
+    {
+        out.push_back((char)((value & 0x7Fu) | 0x80u));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+
+    const sf::Uint8 *window = &m_window[0];
+    std::size_t end = DICTIONARY_SIZE + size;
+    std::size_t pos = DICTIONARY_SIZE;
+    // Start of the literals not yet written out
+    std::size_t anchor = pos;
+    while(((pos + NETCOMPRESS_MIN_MATCH) <= end) && (out.size() < size))
+    {
+        sf::Uint32 slot = hash(&window[pos]);
+        std::size_t candidate = m_table[slot];
+        m_table[slot] = pos + 1u;
+        if((0u == candidate) || ((pos - (candidate - 1u)) > NETCOMPRESS_MAX_OFFSET) ||
+           (0 != memcmp(&window[candidate - 1u], &window[pos], NETCOMPRESS_MIN_MATCH)))
+        {
+            pos++;
+            continue;
+        }
+        std::size_t match = candidate - 1u;
+        std::size_t length = NETCOMPRESS_MIN_MATCH;
+        while(((pos + length) < end) && (window[match + length] == window[pos + length]))
+        {
+            length++;
+        }
+
+        std::size_t literals = pos - anchor;
+        std::size_t extra = length - NETCOMPRESS_MIN_MATCH;
+        std::size_t offset = pos - match;
+        out.push_back((char)((((literals < 15u) ? literals : 15u) << 4) | ((extra < 15u) ? extra : 15u)));
+        if(literals >= 15u)
+        {
+            writeLength(out, literals - 15u);
+        }
+        out.insert(out.end(), &window[anchor], &window[anchor] + literals);
+        out.push_back((char)(offset >> 8));
+        out.push_back((char)offset);
+        if(extra >= 15u)
+        {
+            writeLength(out, extra - 15u);
+        }
+
+        // Let later matches start anywhere in this one
+        for(std::size_t i = pos + 1u; (i < (pos + length)) && ((i + NETCOMPRESS_MIN_MATCH) <= end); i++)
+        {
+            m_table[hash(&window[i])] = i + 1u;
+        }
+        pos += length;
+        anchor = pos;
+    }
+
+    std::size_t literals = end - anchor;
+    out.push_back((char)(((literals < 15u) ? literals : 15u) << 4));
+    if(literals >= 15u)
+    {
+        writeLength(out, literals - 15u);
+    }
+    if(literals > 0u)
+    {
+        out.insert(out.end(), &window[anchor], &window[anchor] + literals);
+    }
+    return (out.size() < size) ? out.size() : 0u;
+}
+
+bool NetCompress::getSize(const char *data, std::size_t size, std::size_t& original)
+{
+    std::size_t ip = 0u;
+    return readVarint((const sf::Uint8 *)data, size, ip, original);
+}
+
+bool NetCompress::decompress(const char *data, std::size_t size, char *out, std::size_t out_size)
+{
+    const sf::Uint8 *in = (const sf::Uint8 *)data;
+    std::size_t ip = 0u;
+    std::size_t original;
+    if((!readVarint(in, size, ip, original)) || (original != out_size))
+    {
+        return false;
+    }
+
+    std::size_t op = 0u;
+    for(;;)
+    {
+        if(ip >= size)
+        {
+            return false;
+        }
+        sf::Uint8 token = in[ip++];
+        std::size_t literals = token >> 4;
+        if((15u == literals) && !readLength(in, size, ip, literals))
+        {
+            return false;
+        }
+        if((literals > (size - ip)) || (literals > (out_size - op)))
+        {
+            return false;
+        }
+        memcpy(&out[op], &in[ip], literals);
+        ip += literals;
+        op += literals;
+        if(ip == size)
+        {
+            // Only the last sequence has no match
+            return (op == out_size);
+        }
+
+        if((ip + 2u) > size)
+        {
+            return false;
+        }
+        std::size_t offset = ((std::size_t)in[ip] << 8) | in[ip + 1u];
+        ip += 2u;
+        std::size_t length = token & 0xFu;
+        if((15u == length) && !readLength(in, size, ip, length))
+        {
+            return false;
+        }
+        length += NETCOMPRESS_MIN_MATCH;
+        if((0u == offset) || (offset > (op + DICTIONARY_SIZE)) || (length > (out_size - op)))
+        {
+            return false;
+        }
+
+        // Byte by byte, since a match may overlap what it is copying
+        for(std::size_t i = 0u; i < length; i++, op++)
+        {
+            if(offset <= op)
+            {
+                out[op] = out[op - offset];
+            }
+            else
+            {
+                out[op] = dictionary[DICTIONARY_SIZE - (offset - op)];
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef NETCOMPRESS_H
+#define NETCOMPRESS_H
+
+#include <vector>
+#include <cstddef>
+#include <SFML/Config.hpp>
+
+// Size of the match finder's hash table, as a power of two
+#define NETCOMPRESS_HASH_BITS 12
+#define NETCOMPRESS_HASH_SIZE (1 << NETCOMPRESS_HASH_BITS)
+
+// Shortest match worth encoding, and the furthest back one can be
+#define NETCOMPRESS_MIN_MATCH 4
+#define NETCOMPRESS_MAX_OFFSET 65535
+
+/*
+ * Small LZ77 codec for message payloads, in the style of LZ4, so it is
+ * fast enough to run on every large message.  Both ends treat a preset
+ * dictionary of byte strings common in our messages as if it came just
+ * before each payload, so even a short message finds matches.
+ *
+ * The compressed data is:
+ *   varint size of the original payload
+ * followed by sequences of:
+ *   Uint8  token, literal count in the high 4 bits and the match
+ *          length less NETCOMPRESS_MIN_MATCH in the low 4 bits
+ *   bytes  255 for each further 255 literals, then the remainder,
+ *          if the literal count in the token is 15
+ *   the literals
+ *   Uint16 offset back from the end of the output to the match
+ *   bytes  the rest of the match length as for the literal count
+ * where the last sequence stops after its literals.  A varint holds
+ * 7 bits per byte, lowest bits first, with the top bit set on every
+ * byte but the last.
+ */
+class NetCompress
+{
+    public:
+        NetCompress();
+        // Returns the size of the compressed data put in out, or 0 if
+        // it came out no smaller than the payload
+        std::size_t compress(const char *data, std::size_t size, std::vector<char>& out);
+        // Size the payload will have once decompressed, false if the
+        // data is not valid
+        static bool getSize(const char *data, std::size_t size, std::size_t& original);
+        // out must have room for getSize() bytes, returns false if the
+        // data is not valid
+        static bool decompress(const char *data, std::size_t size, char *out, std::size_t out_size);
+    protected:
+        static sf::Uint32 hash(const sf::Uint8 *bytes);
+        static void writeLength(std::vector<char>& out, std::size_t length);
+        // Dictionary followed by the payload being compressed
+        std::vector<sf::Uint8> m_window;
+        // Last position in m_window of each hashed 4 byte string
+        std::vector<sf::Uint32> m_table;
+        // m_table filled in with the dictionary alone
+        std::vector<sf::Uint32> m_dictionary_table;
+};
+
+#endif
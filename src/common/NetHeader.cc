@@ -0,0 +1,267 @@
+#include "NetHeader.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+sf::Uint32 NetHeader::getProtocolId()
+{
+    const char *name = NETHEADER_PROTOCOL_NAME;
+    sf::Uint32 hash = FNV_OFFSET_BASIS;
+    for(; '\0' != *name; name++)
+    {
+        hash = (hash ^ (sf::Uint8)*name) * FNV_PRIME;
+    }
+    return (hash ^ NETHEADER_VERSION) * FNV_PRIME;
+}
+
+sf::Uint16 NetHeader::makeCheck(sf::Uint32 protocol_id, sf::Uint16 token, const char *data, std::size_t size)
+{
+    const sf::Uint8 *bytes = (const sf::Uint8 *)data;
+    sf::Uint32 hash = protocol_id;
+    hash = (hash ^ (token >> 8)) * FNV_PRIME;
+    hash = (hash ^ (token & 0xFFu)) * FNV_PRIME;
+    for(std::size_t i = 0u; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return (sf::Uint16)(hash ^ (hash >> 16));
+}
+
+void NetHeader::writeVarint(sf::Packet& datagram, sf::Uint32 value)
+{
+    while(value >= 0x80u)
+    {
+        datagram << (sf::Uint8)((value & 0x7Fu) | 0x80u);
+        value >>= 7;
+    }
+    datagram << (sf::Uint8)value;
+}
+
+std::size_t NetHeader::getVarintSize(sf::Uint32 value)
+{
+    std::size_t size = 1u;
+    while(value >= 0x80u)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+DatagramWriter::DatagramWriter()
+{
+    m_have_sequence = false;
+    m_sequence = 0u;
+}
+
+void DatagramWriter::begin(sf::Packet& datagram, const Datagram_Header_t& header)
+{
+    datagram.clear();
+    datagram << (sf::Uint8)((NETHEADER_VERSION << NETHEADER_VERSION_SHIFT) | (header.flags & ~NETHEADER_VERSION_MASK));
+    NetHeader::writeVarint(datagram, header.connection_id);
+    if(header.flags & NETHEADER_ACK)
+    {
+        // Bit 0, the ack itself, is always set
+        sf::Uint8 run = 1u;
+        while((run < 32u) && (header.ack_bits & ((sf::Uint32)1u << run)))
+        {
+            run++;
+        }
+        sf::Uint32 rest = (run < 31u) ? (header.ack_bits >> (run + 1u)) : 0u;
+        datagram << header.ack;
+        datagram << (sf::Uint8)((0u != rest) ? (run | 0x80u) : run);
+        if(0u != rest)
+        {
+            NetHeader::writeVarint(datagram, rest);
+        }
+    }
+    if(header.flags & NETHEADER_TIMESTAMP)
+    {
+        datagram << header.timestamp;
+    }
+    if(header.flags & NETHEADER_ECHO)
+    {
+        datagram << header.echo;
+    }
+    m_have_sequence = false;
+}
+
+void DatagramWriter::appendMessage(sf::Packet& datagram, sf::Uint8 msg_type, bool has_sequence, sf::Uint16 sequence,
+                                   const char *data, sf::Uint16 length)
+{
+    if(!has_sequence)
+    {
+        datagram << msg_type;
+    }
+    else
+    {
+        datagram << (sf::Uint8)(msg_type | NETHEADER_SEQUENCE_FLAG);
+        if(!m_have_sequence)
+        {
+            datagram << sequence;
+        }
+        else
+        {
+            // Zigzag, so a re-sent message that goes back a little is
+            // as short as the next one along
+            sf::Int16 delta = (sf::Int16)(sf::Uint16)(sequence - m_sequence);
+            NetHeader::writeVarint(datagram, (delta < 0) ? ((sf::Uint32)(-(delta + 1)) * 2u + 1u) : ((sf::Uint32)delta * 2u));
+        }
+        m_have_sequence = true;
+        m_sequence = sequence;
+    }
+    NetHeader::writeVarint(datagram, length);
+    if(length > 0u)
+    {
+        datagram.append(data, length);
+    }
+}
+
+std::size_t DatagramWriter::getFirstFramingSize(bool has_sequence, sf::Uint16 length)
+{
+    return 1u + (has_sequence ? sizeof(sf::Uint16) : 0u) + NetHeader::getVarintSize(length);
+}
+
+void DatagramWriter::finish(sf::Packet& datagram, sf::Uint32 protocol_id, sf::Uint16 token)
+{
+    datagram << NetHeader::makeCheck(protocol_id, token, (const char *)datagram.getData(), datagram.getDataSize());
+}
+
+DatagramReader::DatagramReader(const char *data, std::size_t size)
+{
+    m_data = (const sf::Uint8 *)data;
+    m_size = (size >= NETHEADER_CHECK_SIZE) ? (size - NETHEADER_CHECK_SIZE) : 0u;
+    m_offset = 0u;
+    m_have_sequence = false;
+    m_sequence = 0u;
+}
+
+bool DatagramReader::readVarint(sf::Uint32& value)
+{
+    value = 0u;
+    for(int shift = 0; (shift < 35) && (m_offset < m_size); shift += 7)
+    {
+        sf::Uint8 c = m_data[m_offset++];
+        value |= (sf::Uint32)(c & 0x7Fu) << shift;
+        if(0u == (c & 0x80u))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DatagramReader::readUint16(sf::Uint16& value)
+{
+    if((m_offset + 2u) > m_size)
+    {
+        return false;
+    }
+    value = ((sf::Uint16)m_data[m_offset] << 8) | m_data[m_offset + 1u];
+    m_offset += 2u;
+    return true;
+}
+
+bool DatagramReader::readHeader(Datagram_Header_t& header)
+{
+    sf::Uint32 value;
+    // The cheapest way to tell junk apart, before anything is looked up
+    if((m_size < 2u) || ((m_data[0] & NETHEADER_VERSION_MASK) != (NETHEADER_VERSION << NETHEADER_VERSION_SHIFT)))
+    {
+        return false;
+    }
+    header.flags = m_data[0] & ~NETHEADER_VERSION_MASK;
+    m_offset = 1u;
+    if((!readVarint(value)) || (value > 0xFFFFu))
+    {
+        return false;
+    }
+    header.connection_id = value;
+
+    header.ack = 0u;
+    header.ack_bits = 0u;
+    if(header.flags & NETHEADER_ACK)
+    {
+        if((!readUint16(header.ack)) || (m_offset >= m_size))
+        {
+            return false;
+        }
+        sf::Uint8 run = m_data[m_offset++];
+        bool has_rest = (0u != (run & 0x80u));
+        run &= 0x7Fu;
+        if((0u == run) || (run > 32u) || (has_rest && (run >= 31u)))
+        {
+            return false;
+        }
+        header.ack_bits = (32u == run) ? 0xFFFFFFFFu : (((sf::Uint32)1u << run) - 1u);
+        if(has_rest)
+        {
+            if(!readVarint(value))
+            {
+                return false;
+            }
+            header.ack_bits |= value << (run + 1u);
+        }
+    }
+
+    header.timestamp = 0u;
+    header.echo = 0u;
+    if((header.flags & NETHEADER_TIMESTAMP) && !readUint16(header.timestamp))
+    {
+        return false;
+    }
+    if((header.flags & NETHEADER_ECHO) && !readUint16(header.echo))
+    {
+        return false;
+    }
+    return true;
+}
+
+bool DatagramReader::check(sf::Uint32 protocol_id, sf::Uint16 token)
+{
+    sf::Uint16 check = ((sf::Uint16)m_data[m_size] << 8) | m_data[m_size + 1u];
+    return (check == NetHeader::makeCheck(protocol_id, token, (const char *)m_data, m_size));
+}
+
+bool DatagramReader::readMessage(sf::Uint8& msg_type, sf::Uint16& sequence, const char *& data, sf::Uint16& length)
+{
+    sf::Uint32 value;
+    if(m_offset >= m_size)
+    {
+        return false;
+    }
+    msg_type = m_data[m_offset++];
+    sequence = 0u;
+    if(msg_type & NETHEADER_SEQUENCE_FLAG)
+    {
+        msg_type &= ~NETHEADER_SEQUENCE_FLAG;
+        if(!m_have_sequence)
+        {
+            if(!readUint16(sequence))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            if(!readVarint(value))
+            {
+                return false;
+            }
+            sf::Uint16 delta = (value & 1u) ? (sf::Uint16)~(value >> 1) : (sf::Uint16)(value >> 1);
+            sequence = m_sequence + delta;
+        }
+        m_have_sequence = true;
+        m_sequence = sequence;
+    }
+    // Truncated message, drop the rest of the datagram
+    if((!readVarint(value)) || (value > (m_size - m_offset)))
+    {
+        m_offset = m_size;
+        return false;
+    }
+    length = value;
+    data = (const char *)&m_data[m_offset];
+    m_offset += length;
+    return true;
+}
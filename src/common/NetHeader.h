@@ -0,0 +1,131 @@
+#ifndef NETHEADER_H
+#define NETHEADER_H
+
+#include <cstddef>
+#include <SFML/Config.hpp>
+#include <SFML/Network.hpp>
+
+// Changes whenever the datagram format does, goes in the top bits of
+// the flags and into the protocol id
+#define NETHEADER_VERSION 1u
+#define NETHEADER_VERSION_SHIFT 5
+#define NETHEADER_VERSION_MASK 0xE0u
+
+// Name hashed with the version to give the protocol id
+#define NETHEADER_PROTOCOL_NAME "treacherous-terrain"
+
+// Flags saying which of the optional header fields are present
+#define NETHEADER_ACK 0x01u
+#define NETHEADER_TIMESTAMP 0x02u
+#define NETHEADER_ECHO 0x04u
+
+// Set in the type byte of a message that carries a sequence number,
+// the top bit is left for the sender's own use
+#define NETHEADER_SEQUENCE_FLAG 0x40u
+
+// Size of the check at the end of every datagram
+#define NETHEADER_CHECK_SIZE 2
+
+// Most bytes the header and the check can take up
+#define NETHEADER_MAX_SIZE (1 + 3 + 2 + 1 + 5 + 2 + 2 + NETHEADER_CHECK_SIZE)
+
+// Most bytes the framing of one message can take up
+#define NETHEADER_MAX_MESSAGE_SIZE (1 + 3 + 3)
+
+typedef struct{
+    // NETHEADER_ACK etc., without the version
+    sf::Uint8 flags;
+    sf::Uint16 connection_id;
+    sf::Uint16 ack;
+    sf::Uint32 ack_bits;
+    sf::Uint16 timestamp;
+    sf::Uint16 echo;
+} Datagram_Header_t;
+
+/*
+ * Every datagram is laid out as:
+ *   Uint8  flags, NETHEADER_VERSION in the top 3 bits
+ *   varint connection id
+ *   Uint16 ack              \ if NETHEADER_ACK
+ *   Uint8  ack run           |
+ *   varint rest of ack bits / if the top bit of the ack run is set
+ *   Uint16 timestamp          if NETHEADER_TIMESTAMP
+ *   Uint16 echo               if NETHEADER_ECHO
+ *   messages
+ *   Uint16 check
+ * The ack bits are sent as the number of them set in a row from bit 0,
+ * which is all of them for a link that is not losing anything, and only
+ * if any above the first gap are set, those bits shifted down to start
+ * just above the gap.
+ *
+ * Each message is framed as:
+ *   Uint8  type, with NETHEADER_SEQUENCE_FLAG set if a sequence follows
+ *   Uint16 sequence for the first message in the datagram that has one,
+ *   varint zigzag of the difference from the one before for the rest
+ *   varint payload length
+ *   payload
+ * so messages coalesced into one datagram, which are mostly numbered
+ * one after another, take 3 bytes of framing.
+ *
+ * The check is the low 16 bits of an FNV-1a hash, folded in half, of
+ * the token of the connection and every byte before the check, starting
+ * from the protocol id rather than the usual offset basis.  The protocol
+ * id is the FNV-1a hash of NETHEADER_PROTOCOL_NAME and the version, so
+ * datagrams from other programs, other versions of ours, or for another
+ * connection are dropped, and a version mismatch on its own is seen
+ * from the first byte.
+ *
+ * Fixed size numbers are big endian.  A varint holds 7 bits per byte,
+ * lowest bits first, with the top bit set on every byte but the last.
+ */
+class NetHeader
+{
+    public:
+        static sf::Uint32 getProtocolId();
+        static sf::Uint16 makeCheck(sf::Uint32 protocol_id, sf::Uint16 token, const char *data, std::size_t size);
+        static void writeVarint(sf::Packet& datagram, sf::Uint32 value);
+        static std::size_t getVarintSize(sf::Uint32 value);
+};
+
+// Builds a datagram up in an sf::Packet
+class DatagramWriter
+{
+    public:
+        DatagramWriter();
+        void begin(sf::Packet& datagram, const Datagram_Header_t& header);
+        void appendMessage(sf::Packet& datagram, sf::Uint8 msg_type, bool has_sequence, sf::Uint16 sequence,
+                           const char *data, sf::Uint16 length);
+        void finish(sf::Packet& datagram, sf::Uint32 protocol_id, sf::Uint16 token);
+        // Bytes of framing a message takes as the first in a datagram
+        static std::size_t getFirstFramingSize(bool has_sequence, sf::Uint16 length);
+    protected:
+        bool m_have_sequence;
+        sf::Uint16 m_sequence;
+};
+
+// Takes a received datagram apart without copying it
+class DatagramReader
+{
+    public:
+        DatagramReader(const char *data, std::size_t size);
+        // False if the datagram is too short or of another version
+        bool readHeader(Datagram_Header_t& header);
+        bool check(sf::Uint32 protocol_id, sf::Uint16 token);
+        // False once there are no more whole messages.  The type comes
+        // back without NETHEADER_SEQUENCE_FLAG, and sequence is 0 for
+        // a message without one.
+        bool readMessage(sf::Uint8& msg_type, sf::Uint16& sequence, const char *& data, sf::Uint16& length);
+        // Bytes read so far
+        std::size_t getOffset() const { return m_offset; }
+    protected:
+        bool readVarint(sf::Uint32& value);
+        bool readUint16(sf::Uint16& value);
+        const sf::Uint8 *m_data;
+        // Not counting the check
+        std::size_t m_size;
+        std::size_t m_offset;
+        bool m_have_sequence;
+        sf::Uint16 m_sequence;
+};
+
+#endif
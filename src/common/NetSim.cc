@@ -0,0 +1,170 @@
+#include <cstdlib>
+#include "NetSim.h"
+
+NetSim::NetSim()
+{
+    NetSim_Config_t config;
+    defaults(config);
+    configure(config);
+}
+
+void NetSim::defaults(NetSim_Config_t& config)
+{
+    config.latency = 0.0;
+    config.jitter = 0.0;
+    config.loss = 0.0;
+    config.duplicate = 0.0;
+    config.reorder = 0.0;
+    config.bandwidth = 0.0;
+    config.seed = 1u;
+}
+
+void NetSim::configure(const NetSim_Config_t& config)
+{
+    m_config = config;
+    m_enabled = (config.latency > 0.0) || (config.jitter > 0.0) ||
+                (config.loss > 0.0) || (config.duplicate > 0.0) ||
+                (config.reorder > 0.0) || (config.bandwidth > 0.0);
+    clear();
+}
+
+void NetSim::clear()
+{
+    // Zero would stop the generator
+    m_state = (0u != m_config.seed) ? m_config.seed : 1u;
+    m_queue.clear();
+    m_link_free = 0.0;
+    m_last_due = 0.0;
+}
+
+/*
+ * Parse a comma separated list of settings, for example
+ *   latency=0.1,jitter=0.02,loss=0.05,dup=0.01,reorder=0.01,bandwidth=20000,seed=7
+ * Any setting not given keeps its current value.  Returns false if the
+ * list could not be parsed.
+ */
+bool NetSim::parse(const std::string& spec, NetSim_Config_t& config)
+{
+    std::string::size_type start = 0;
+    while(start < spec.size())
+    {
+        std::string::size_type end = spec.find(',', start);
+        if(std::string::npos == end)
+        {
+            end = spec.size();
+        }
+        std::string setting = spec.substr(start, end - start);
+        std::string::size_type equals = setting.find('=');
+        if(std::string::npos == equals)
+        {
+            return false;
+        }
+        std::string name = setting.substr(0, equals);
+        const char *value_str = setting.c_str() + equals + 1;
+        char *value_end;
+        double value = strtod(value_str, &value_end);
+        if((value_end == value_str) || ('\0' != *value_end))
+        {
+            return false;
+        }
+
+        if(name == "latency")
+            config.latency = value;
+        else if(name == "jitter")
+            config.jitter = value;
+        else if(name == "loss")
+            config.loss = value;
+        else if((name == "dup") || (name == "duplicate"))
+            config.duplicate = value;
+        else if(name == "reorder")
+            config.reorder = value;
+        else if(name == "bandwidth")
+            config.bandwidth = value;
+        else if(name == "seed")
+            config.seed = (sf::Uint32)value;
+        else
+            return false;
+        start = end + 1;
+    }
+    return true;
+}
+
+// Uniform in [0, 1), from a xorshift generator
+double NetSim::random()
+{
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 17;
+    m_state ^= m_state << 5;
+    return m_state / 4294967296.0;
+}
+
+void NetSim::push(const char *data, std::size_t size, const sf::IpAddress& addr, unsigned short port, double now)
+{
+    if(random() < m_config.loss)
+    {
+        return;
+    }
+
+    double departure = now;
+    if(m_config.bandwidth > 0.0)
+    {
+        // Wait for the link to finish what it is already sending
+        if(m_link_free > departure)
+        {
+            departure = m_link_free;
+        }
+        if((departure - now) > NETSIM_MAX_QUEUE_DELAY)
+        {
+            return;
+        }
+        departure += size / m_config.bandwidth;
+        m_link_free = departure;
+    }
+
+    Sim_Datagram_t datagram;
+    datagram.data.assign(data, data + size);
+    datagram.addr = addr;
+    datagram.port = port;
+
+    int copies = (random() < m_config.duplicate) ? 2 : 1;
+    for(int i = 0; i < copies; i++)
+    {
+        double due = departure + m_config.latency + m_config.jitter * random();
+        bool reordered = (random() < m_config.reorder);
+        if(reordered)
+        {
+            // Hold it back behind some of the datagrams that follow
+            due += m_config.latency + m_config.jitter + 0.01 * random();
+        }
+        schedule(datagram, due, reordered);
+    }
+}
+
+void NetSim::schedule(const Sim_Datagram_t& datagram, double due, bool reordered)
+{
+    if(!reordered)
+    {
+        // Jitter alone does not change the order datagrams arrive in
+        if(due < m_last_due)
+        {
+            due = m_last_due;
+        }
+        m_last_due = due;
+    }
+    m_queue.insert(std::make_pair(due, datagram));
+}
+
+// Take the next datagram that is due, if there is one
+bool NetSim::pop(double now, std::vector<char>& data, sf::IpAddress& addr, unsigned short& port)
+{
+    if(m_queue.empty() || (m_queue.begin()->first > now))
+    {
+        return false;
+    }
+    Sim_Datagram_t& datagram = m_queue.begin()->second;
+    data.swap(datagram.data);
+    addr = datagram.addr;
+    port = datagram.port;
+    m_queue.erase(m_queue.begin());
+    return true;
+}
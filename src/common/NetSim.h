@@ -0,0 +1,70 @@
+#ifndef NETSIM_H
+#define NETSIM_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <SFML/Config.hpp>
+#include <SFML/Network.hpp>
+
+// Longest a datagram may wait for the bandwidth cap before it is
+// dropped, in seconds, as a router queue would.
+#define NETSIM_MAX_QUEUE_DELAY 1.0
+
+// Conditions of the simulated link, in each direction
+typedef struct{
+    // One way delay, in seconds
+    double latency;
+    // Random extra delay of up to this many seconds
+    double jitter;
+    // Probability of dropping, duplicating or reordering a datagram
+    double loss;
+    double duplicate;
+    double reorder;
+    // Bytes per second, zero for no limit
+    double bandwidth;
+    // The same seed always gives the same sequence of conditions
+    sf::Uint32 seed;
+} NetSim_Config_t;
+
+/*
+ * Holds datagrams back to simulate a poor network link.  Datagrams are
+ * pushed as they would have been sent or received, and popped once
+ * they are due.  Everything random comes from a generator seeded by
+ * the configuration, so a run can be repeated exactly.
+ */
+class NetSim
+{
+    public:
+        NetSim();
+        void configure(const NetSim_Config_t& config);
+        bool enabled() { return m_enabled; }
+        void push(const char *data, std::size_t size, const sf::IpAddress& addr, unsigned short port, double now);
+        bool pop(double now, std::vector<char>& data, sf::IpAddress& addr, unsigned short& port);
+        bool pending() { return !m_queue.empty(); }
+        void clear();
+        static void defaults(NetSim_Config_t& config);
+        static bool parse(const std::string& spec, NetSim_Config_t& config);
+    protected:
+        typedef struct{
+            std::vector<char> data;
+            sf::IpAddress addr;
+            unsigned short port;
+        } Sim_Datagram_t;
+
+        double random();
+        void schedule(const Sim_Datagram_t& datagram, double due, bool reordered);
+
+        NetSim_Config_t m_config;
+        bool m_enabled;
+        sf::Uint32 m_state;
+        // Datagrams waiting to be delivered, by due time
+        std::multimap<double, Sim_Datagram_t> m_queue;
+        // Time the simulated link has finished sending what it was given
+        double m_link_free;
+        // Latest due time so far, datagrams not picked to be reordered
+        // are never delivered ahead of it
+        double m_last_due;
+};
+
+#endif
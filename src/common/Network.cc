@@ -2,30 +2,100 @@
 #include <cstring>
 #include <cstdlib>
 #include <iostream>
+#include <ctime>
+#ifdef NETWORK_USE_MMSG
+#include <errno.h>
+#include <arpa/inet.h>
+#endif
+#ifdef NETWORK_USE_EVENTFD
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
 
-sf::Uint32 Network::getUniqueMessageId( void )
+static sf::Uint16 readUint16(const char *data)
 {
-    sf::Uint32 next_msg_uid = 0;
-    while(transmit_queue.find(next_msg_uid) != transmit_queue.end())
+    const sf::Uint8 *bytes = (const sf::Uint8 *)data;
+    return (sf::Uint16)((bytes[0] << 8) | bytes[1]);
+}
+
+static void writeUint16(char *data, sf::Uint16 value)
+{
+    data[0] = (char)(value >> 8);
+    data[1] = (char)value;
+}
+
+static sf::Uint32 readUint32(const char *data)
+{
+    const sf::Uint8 *bytes = (const sf::Uint8 *)data;
+    return ((sf::Uint32)bytes[0] << 24) | ((sf::Uint32)bytes[1] << 16) |
+           ((sf::Uint32)bytes[2] << 8) | (sf::Uint32)bytes[3];
+}
+
+Network::Network()
+    : pool(RECEIVE_BUFFER_SIZE)
+{
+    numclients = 0;
+    rx_message = MESSAGE_NONE;
+    protocol_id = NetHeader::getProtocolId();
+    capture_start = 0.0;
+    compression = false;
+    replaying = false;
+    replay_fast = false;
+    replay_time = 0.0;
+    replay_have_next = false;
+    threaded = false;
+    io_running = 0;
+    io_pending = 0u;
+    io_numclients = 0u;
+    wake_fd = -1;
+    game_dropped = 0u;
+    io_state.state_change = true;
+    stats_published = 0.0;
+    stats_next = 0u;
+    memset(&game_totals, 0, sizeof(game_totals));
+}
+
+Network::~Network()
+{
+    stopThread();
+#ifdef NETWORK_USE_EVENTFD
+    if(wake_fd >= 0)
     {
-        next_msg_uid++;
+        close(wake_fd);
     }
-    return next_msg_uid;
+#endif
 }
 
 void Network::Create(sf::Uint16 port, sf::IpAddress address )
 {
-    sf::Uint16 current_client = 0;
-    Client_t tmpclient;
-
     Reset();
+    // Room for every client up front, so the table never has to grow
+    // while clients are connecting
+    clients.reserve(MAX_NUM_CLIENTS);
+    for(int i = 0; i < NETWORK_BATCH_SIZE; i++)
+    {
+        rx_messages[i] = pool.acquire(RECEIVE_BUFFER_SIZE);
+    }
+#ifdef NETWORK_USE_MMSG
+    initBatches();
+#endif
 
-    if(sf::IpAddress::None != address)
+    // Only needs to be hard to guess from outside
+    rng_state = ((sf::Uint32)time(NULL) * 2654435761u) ^ (sf::Uint32)(std::size_t)this ^ port;
+    if(0u == rng_state)
     {
-        tmpclient.addr = address;
-        tmpclient.port = port;
-        tmpclient.disconnect = DISCONNECTED;
-        numclients = addClients(&tmpclient, &current_client);
+        rng_state = 1u;
+    }
+    secret = random();
+
+    is_server = (sf::IpAddress::None == address);
+    if(!is_server)
+    {
+        // Start the handshake with the server
+        Client_t* server = addClient(address, port);
+        server->disconnect = CONNECTING;
+        server->nonce = random();
+        server->handshake_sent = -NETWORK_CONNECT_RETRY;
 
         if(sf::Socket::Done != net_socket.bind( sf::Socket::AnyPort ))
         {
@@ -47,443 +117,2412 @@ void Network::Destroy( void )
     net_socket.unbind();
 }
 
-bool Network::getData(sf::Packet& p,  sf::Uint8* sending_client)
+bool Network::getData(sf::Packet& p,  Client_Id_t* sending_client)
 {
-    bool rtn = false;
-    sf::Uint16 curcl;
-
-    // Recurse through the client array and return if there is any
-    // received data for a given client
-    for(curcl = 0; curcl < numclients; (curcl)++)
+    // Messages handed over by the network thread come first, there may
+    // still be some left after it has been stopped.
+    if(popDelivered())
     {
-        if(!clients[curcl].receive.empty())
+        p = game_received.Data;
+        if(sending_client != NULL)
         {
-            p = clients[curcl].receive.front();
-            clients[curcl].receive.pop();
-            if(sending_client != NULL)
-            {
-                *sending_client = curcl;
-            }
-            rtn = true;
-            break;
+            *sending_client = game_received.client;
         }
+        return true;
     }
-
-
-    return rtn;
+    if(threaded)
+    {
+        return false;
+    }
+    return takeReceived(p, sending_client);
 }
 
-bool Network::queueTransmitMessage(Network_Messages_T msg_type , sf::Packet p, Client_t * dest)
+/*
+ * Like getData(), but rather than copying the message into a packet,
+ * points the view at it in the buffer it was received into.  The
+ * buffer is held until the view is passed to releaseMessage() or to
+ * the next call, so
+ *     while(net.getMessage(view)) { view >> ...; }
+ * holds only one message at a time and none once the loop ends.
+ * With the network thread running the messages are copied over from
+ * the thread, and the view is into the copy.  Views must be released
+ * before the thread is started or the network is destroyed.
+ */
+bool Network::getMessage(PacketView& view, Client_Id_t* sending_client)
 {
-    bool added_message_to_queue = false;
-    // Only queue a message if there are clients to receive it
-    if(numclients > 0)
+    releaseMessage(view);
+    if(popDelivered())
     {
-        sf::Packet packet;
-        sf::Uint8 type = (sf::Uint8)msg_type;
-        sf::Uint32 uid = UNIQUE_ID;
-        sf::Uint32 msg_id = getUniqueMessageId();
-        Transmit_Message_t* message = new Transmit_Message_t();
-
-        // Add this to the list of packets expecting a response
-        packet << uid;
-        packet << type;
-        packet << msg_id;
-        packet.append(p.getData(), p.getDataSize());
+        view.set((const char *)game_received.Data.getData(), game_received.Data.getDataSize(),
+                 PACKET_VIEW_NONE);
+        if(sending_client != NULL)
+        {
+            *sending_client = game_received.client;
+        }
+        return true;
+    }
+    Received_View_t received;
+    if(threaded || !takeView(received, sending_client))
+    {
+        return false;
+    }
+    view.set(pool.getData(received.message) + received.offset, received.length, received.message);
+    return true;
+}
 
-        message->msg_type = msg_type;
-        message->Data = packet;
-        message->TimeStarted = 0.0;
-        message->dest = dest;
+void Network::releaseMessage(PacketView& view)
+{
+    if(PACKET_VIEW_NONE != view.m_message)
+    {
+        pool.release(view.m_message);
+    }
+    view.set(NULL, 0u, PACKET_VIEW_NONE);
+}
 
-        transmit_queue[msg_id] = message;
+bool Network::takeReceived(sf::Packet& p, Client_Id_t* sending_client)
+{
+    Received_View_t received;
+    if(!takeView(received, sending_client))
+    {
+        return false;
+    }
+    // Copied into the caller's packet, which keeps its memory
+    // from one call to the next.
+    p.clear();
+    p.append(pool.getData(received.message) + received.offset, received.length);
+    pool.release(received.message);
+    return true;
+}
 
-        added_message_to_queue = true;
+// Take the next message from the clients that have received data,
+// going round the clients in turn.  The caller gets the reference to
+// the buffer it is in.
+bool Network::takeView(Received_View_t& received, Client_Id_t* sending_client)
+{
+    while(!ready_clients.empty())
+    {
+        Client_t* client = clients[ready_clients.front()];
+        ready_clients.pop_front();
+        if(!client->receive.empty())
+        {
+            received = client->receive.front();
+            client->receive.pop_front();
+            client->receive_head++;
+            if(!client->receive.empty())
+            {
+                ready_clients.push_back(client->handle);
+            }
+            if(sending_client != NULL)
+            {
+                *sending_client = NETWORK_CLIENT_ID(client->handle, client->generation);
+            }
+            return true;
+        }
     }
+    return false;
+}
 
-    return added_message_to_queue;
+// Takes over the reference to the buffer
+void Network::queueReceived(Client_t *client, const Received_View_t& received)
+{
+    if(client->receive.empty())
+    {
+        ready_clients.push_back(client->handle);
+    }
+    client->receive.push_back(received);
 }
 
-bool Network::sendData(sf::Packet& p, bool guaranteed)
+// Refer to a received message where it is if it is still in the buffer
+// its datagram was received into, and otherwise copy it into the pool.
+Received_View_t Network::keepReceived(const char *data, std::size_t size)
 {
-    Network_Messages_T message_type = NETWORK_NORMAL;
-    if(guaranteed)
+    Received_View_t received;
+    if(MESSAGE_NONE != rx_message)
+    {
+        pool.addRef(rx_message);
+        received.message = rx_message;
+        received.offset = data - pool.getData(rx_message);
+    }
+    else
     {
-        message_type = NETWORK_GUARANTEED;
+        received.message = copyToPool(data, size);
+        received.offset = 0u;
     }
+    received.length = size;
+    return received;
+}
 
-    queueTransmitMessage(message_type, p);
+// A view of the whole of a pooled message
+Received_View_t Network::wholeMessage(sf::Uint32 message)
+{
+    Received_View_t received;
+    received.message = message;
+    received.offset = 0u;
+    received.length = pool.getSize(message);
+    return received;
+}
 
-    return true;
+sf::Uint32 Network::copyToPool(const char *data, std::size_t size)
+{
+    sf::Uint32 message = pool.acquire(size);
+    if(size > 0u)
+    {
+        memcpy(pool.getData(message), data, size);
+    }
+    return message;
 }
 
-int Network::addClients(Client_t *client, sf::Uint16 *curcl)
+// Hand over a sequenced message only if it is newer than anything
+// received on its channel.  If an older message from the same channel
+// is still waiting in getData(), it is replaced rather than queueing
+// both, so only the newest state is ever seen.
+void Network::queueSequenced(Client_t *client, sf::Uint16 sequence, const char *data, sf::Uint16 length)
 {
-    int i;
-    int nc = -1;
-    for(i=0;i<MAX_NUM_CLIENTS;i++)
+    if(length < 1u)
     {
-        if((clients[i].addr == client->addr) && (clients[i].port == client->port))
-        {
-            nc = i;
-        }
-        else if((clients[i].addr == sf::IpAddress::None) && (clients[i].port == 0))
-        {
-            break;
-        }
+        return;
     }
-    // Make sure to set the current client location, otherwise
-    // bad stuffs can happen.
-    if(nc == -1)
+    sf::Uint8 channel = data[0];
+    std::map<sf::Uint8, Sequenced_Channel_t>::iterator iter = client->sequenced.find(channel);
+    if(client->sequenced.end() == iter)
     {
-        clients[i].addr = client->addr;
-        clients[i].port = client->port;
-        // Set that a client is now connected
-        clients[i].disconnect = CONNECTED;
-        *curcl = i;
-        i++;
+        Sequenced_Channel_t state;
+        state.latest = sequence;
+        state.queued_at = client->receive_head - 1u;
+        iter = client->sequenced.insert(std::make_pair(channel, state)).first;
+    }
+    else if(sequenceGreaterThan(sequence, iter->second.latest))
+    {
+        iter->second.latest = sequence;
+    }
+    else
+    {
+        // Stale or duplicate
+        return;
+    }
+
+    Received_View_t received = keepReceived(&data[1], length - 1u);
+    sf::Uint32 position = iter->second.queued_at - client->receive_head;
+    if(position < client->receive.size())
+    {
+        pool.release(client->receive[position].message);
+        client->receive[position] = received;
     }
     else
     {
-        *curcl = nc;
+        iter->second.queued_at = client->receive_head + client->receive.size();
+        queueReceived(client, received);
     }
-    return i;
 }
 
-int Network::findClient(Client_t *client)
+// A message goes to dest if one is given, and otherwise to every
+// client in one of the groups, or every client if groups is 0.
+bool Network::isRecipient(Client_t *client, Client_t *dest, sf::Uint32 groups)
 {
-    int client_ndx;
-    for(client_ndx = 0; client_ndx < MAX_NUM_CLIENTS; client_ndx++)
+    if(NULL != dest)
     {
-        if((clients[client_ndx].addr == client->addr) && (clients[client_ndx].port == client->port))
-        {
-            break;
-        }
+        return (client == dest);
     }
-    return client_ndx;
+    return ((0u == groups) || (0u != (client->groups & groups)));
 }
 
-
-void Network::Receive()
+bool Network::queueTransmitMessage(Network_Messages_T msg_type, const char *data, std::size_t size, Client_t * dest, sf::Uint32 groups)
 {
-    // Get any received packets
-    sf::IpAddress sender;
-    Client_t tmpclient;
-    sf::Uint16 curcl;
-    sf::Packet receive_packet;
-    receive_packet.clear();
+    bool added_message_to_queue = false;
+    if(size > NETWORK_MAX_MESSAGE_SIZE)
+    {
+        return false;
+    }
 
-    // Receive any packets from the server
-    while(net_socket.receive(receive_packet, tmpclient.addr, tmpclient.port) == sf::Socket::Done)
+    // Only queue a message if there are clients to receive it
+    if(numclients > 0)
     {
-        sf::Uint32 uid;
-        receive_packet >> uid;
-        if(uid == UNIQUE_ID)
+        // Large reliable messages are worth the time it takes to
+        // compress them, the rest go as they are.
+        sf::Uint8 flags = 0u;
+        if(compression && (NETWORK_GUARANTEED == msg_type) && (size >= NETWORK_COMPRESS_THRESHOLD))
         {
-            sf::Uint8 message_type;
-            sf::Uint32 msg_id;
-            receive_packet >> message_type;
-            receive_packet >> msg_id;
-
-            numclients = addClients(&tmpclient, &curcl);
-
-            switch((Network_Messages_T)message_type)
+            compress_timer.restart();
+            std::size_t compressed = codec.compress(data, size, compress_buff);
+            compress_stats.seconds += compress_timer.getElapsedTime().asSeconds();
+            compress_stats.bytes_in += size;
+            if(compressed > 0u)
             {
-                case NETWORK_CONNECT:
-                {
-                    break;
-                }
-                case NETWORK_DISCONNECT:
-                {
-                    break;
-                }
-                case NETWORK_ACK:
-                {
-                    sf::Uint32 client_id = findClient(&tmpclient);
-                    receive_packet >> message_type;
-                    receive_packet >> msg_id;
+                data = &compress_buff[0];
+                size = compressed;
+                flags = NETWORK_COMPRESSED_FLAG;
+                compress_stats.messages_compressed++;
+            }
+            else
+            {
+                compress_stats.messages_skipped++;
+            }
+            compress_stats.bytes_out += size;
+        }
 
-                    switch(message_type)
-                    {
-                        // Handle an acknowledged ping message
-                        case NETWORK_PING:
-                        {
-                            if(MAX_NUM_CLIENTS > client_id)
-                            {
-                                clients[client_id].ping = network_timer.getElapsedTime().asSeconds() - transmit_queue[msg_id]->TimeStarted;
-
-                                // Need to also register that a ping message was received.
-                                transmit_queue[msg_id]->Responses[&clients[client_id]] = network_timer.getElapsedTime().asSeconds();
-                                // Received a response, so reset send attempts.
-                                clients[client_id].num_send_attempts = 0u;
-                            }
-                            break;
-                        }
-                        // Handle an acknowledged guaranteed message
-                        case NETWORK_GUARANTEED:
-                        {
-                            // Set that the message was acknowledged by the client
-                            if(MAX_NUM_CLIENTS > client_id)
-                            {
-                                transmit_queue[msg_id]->Responses[&clients[client_id]] = network_timer.getElapsedTime().asSeconds();
-
-                                // Received a response, so reset send attempts.
-                                clients[client_id].num_send_attempts = 0u;
-                            }
-                            break;
-                        }
+        if(size > NETWORK_MAX_PAYLOAD)
+        {
+            // Too big for a datagram, there is no point sending the
+            // pieces unreliably since losing one loses the lot.
+            queueFragments(data, size, flags, dest, groups);
+        }
+        else
+        {
+            queueMessage(msg_type, flags, copyToPool(data, size), dest, groups);
+        }
 
-                        default:
-                            break; // What the heck happened?
-                    }
-                    break;
-                }
-                case NETWORK_PING:
-                {
-                    // Send a response indicating that ping was received
-                    sf::Packet response;
-                    response.clear();
-                    response << message_type << msg_id;
-                    queueTransmitMessage(NETWORK_ACK, response, &(clients[curcl]));
-                    break;
-                }
+        added_message_to_queue = true;
+    }
 
-                case NETWORK_NORMAL:
-                {
-                    // Handle any remaining data in the packet
-                    clients[curcl].receive.push(receive_packet);
-                    break;
-                }
+    return added_message_to_queue;
+}
 
-                case NETWORK_GUARANTEED:
+// Queue a pooled message, taking over the reference to it
+void Network::queueMessage(Network_Messages_T msg_type, sf::Uint8 flags, sf::Uint32 message, Client_t * dest, sf::Uint32 groups)
+{
+    switch(msg_type)
+    {
+        case NETWORK_FRAGMENT:
+        case NETWORK_GUARANTEED:
+        {
+            // Each client tracks its own delivery of a guaranteed message,
+            // the sequence number is assigned by the client's window.
+            // They all share the one copy of the payload.
+            for(unsigned int i = 0; i < clients.size(); i++)
+            {
+                if((clients[i]->disconnect != DISCONNECTED) &&
+                   isRecipient(clients[i], dest, groups))
                 {
-                    // Send a response indicating that the message was received
-                    sf::Packet response;
-                    clients[curcl].receive.push(receive_packet);
-                    response.clear();
-                    response << message_type << msg_id;
-                    queueTransmitMessage(NETWORK_ACK, response, &(clients[curcl]));
-                    break;
+                    pool.addRef(message);
+                    clients[i]->window->push((sf::Uint8)msg_type | flags, message);
                 }
-
-                // Nothing to do
-                default:
-                    break;
             }
+            pool.release(message);
+            break;
+        }
+
+        default:
+        {
+            // The header is added per client when the message is sent
+            Transmit_Message_t transmit;
+            transmit.message = message;
+            transmit.msg_type = msg_type;
+            transmit.dest = dest;
+            transmit.groups = groups;
+
+            transmit_queue.push_back(transmit);
+            break;
         }
     }
 }
 
-void Network::Transmit()
+// Split a large message into pieces that each fit in a datagram
+void Network::queueFragments(const char *data, std::size_t size, sf::Uint8 flags, Client_t *dest, sf::Uint32 groups)
 {
-    // Broadcast the mesages to all clients
-    sf::Uint32 msg_id = 0;
-    static double ping_timer = network_timer.getElapsedTime().asSeconds();
-    double current_time = network_timer.getElapsedTime().asSeconds();
-
-    // Every five seconds, send ping messages
-    // Note this time must be longer than the combined
-    // timeout and retry count, otherwise a client will never
-    // be removed.
-    if((current_time - ping_timer) > 1.0)
-    {
-        ping_timer = current_time;
-        sf::Packet response;
-        response.clear();
-        queueTransmitMessage(NETWORK_PING, response);
-    }
+    sf::Uint16 id = next_fragmented++;
+    sf::Uint16 count = (size + FRAGMENT_PAYLOAD_SIZE - 1) / FRAGMENT_PAYLOAD_SIZE;
 
-    // Set any clients waiting to be removed to the
-    // do removal state.  This will get changed in the
-    // Transmit loop below if there are any pending messages
-    for(int client_ndx = 0; client_ndx < MAX_NUM_CLIENTS; client_ndx++)
+    for(sf::Uint16 index = 0; index < count; index++)
     {
-        if(clients[client_ndx].disconnect == WAIT_DISCONNECT)
+        sf::Uint32 offset = (sf::Uint32)index * FRAGMENT_PAYLOAD_SIZE;
+        sf::Uint32 length = size - offset;
+        if(length > FRAGMENT_PAYLOAD_SIZE)
         {
-            clients[client_ndx].disconnect = DO_DISCONNECT;
+            length = FRAGMENT_PAYLOAD_SIZE;
         }
+        sf::Uint32 fragment = pool.acquire(FRAGMENT_HEADER_SIZE + length);
+        char *buffer = pool.getData(fragment);
+        writeUint16(&buffer[0], id);
+        writeUint16(&buffer[2], index);
+        writeUint16(&buffer[4], count);
+        memcpy(&buffer[FRAGMENT_HEADER_SIZE], &data[offset], length);
+        queueMessage(NETWORK_FRAGMENT, flags, fragment, dest, groups);
     }
+}
 
-    // Send any pending messages
-    while(transmit_queue.find(msg_id) != transmit_queue.end())
+// False for a new fragment that would start one reassembly more than
+// MAX_NUM_REASSEMBLIES.  Re-sent ones still go through, to be
+// acknowledged again.
+bool Network::canReassemble(Client_t *client, sf::Uint16 msg_id, const char *data, sf::Uint16 length)
+{
+    if((client->reassembly.size() < MAX_NUM_REASSEMBLIES) || (length < FRAGMENT_HEADER_SIZE) ||
+       client->received->isDuplicate(msg_id))
     {
-        double curTime = network_timer.getElapsedTime().asSeconds();
-        Transmit_Message_t * message = transmit_queue[msg_id];
-        switch(message->msg_type)
-        {
-            case NETWORK_PING:
-            case NETWORK_GUARANTEED:
-            {
-                // If the message has not yet been sent
-                // send the message and update the sent times.
-                if(0.0 == message->TimeStarted)
-                {
-                    message->TimeStarted = network_timer.getElapsedTime().asSeconds();
-                    for(int i = 0; i < MAX_NUM_CLIENTS; i++)
-                    {
-                        if((clients[i].addr != sf::IpAddress::None) && (clients[i].port != 0))
-                        {
-                            message->ClientTimeSent[&clients[i]] = message->TimeStarted;
-                            net_socket.send(message->Data, clients[i].addr, clients[i].port);
-                        }
-                    }
-                }
-                else
-                {
-                    // Message has already been sent, check to see if a response has been received
-                    // if not, send another request after retry timer expired.
-                    if(message->ClientTimeSent.size() > message->Responses.size())
-                    {
-                        // Look for any clients that haven't responded
-                        for ( std::map<Client_t*, double>::iterator iter = message->ClientTimeSent.begin(); iter != message->ClientTimeSent.end(); ++iter )
-                        {
-                            // Determine if enough time has elapsed to try and re-send
-                            if((curTime - iter->second) >= NETWORK_TIMEOUT)
-                            {
-                                // Determine if a response was already received from this client
-                                if(message->Responses.find(iter->first) == message->Responses.end())
-                                {
-                                    // Resend the message to the client
-                                    net_socket.send(message->Data, iter->first->addr, iter->first->port);
-                                    message->ClientTimeSent[iter->first] = curTime;
-
-                                    // Keep track of the number of attempts
-                                    // if the number of attempts is exceeded, fake a receive message
-                                    // and set a timeout disconnect state
-                                    iter->first->num_send_attempts++;
-                                    if(MAX_NUM_SEND_ATTEMPTS < iter->first->num_send_attempts)
-                                    {
-                                        // Fake a receive message so that it will complete and be removed from the queue
-                                        message->Responses[iter->first] = network_timer.getElapsedTime().asSeconds();
-                                        iter->first->disconnect = TIMEOUT_DISCONNECT;
-                                    }
-                                }
-                            }
-
-                            // There are still pending messages for this client
-                            // Move back to wait state.
-                            if(iter->first->disconnect == DO_DISCONNECT)
-                            {
-                                iter->first->disconnect = WAIT_DISCONNECT;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        // All clients have received the message, so remove it from the list
-                        delete message;
-                        transmit_queue.erase(transmit_queue.find(msg_id));
-                    }
-                }
-                break;
-            }
+        return true;
+    }
+    return (client->reassembly.end() != client->reassembly.find(readUint16(&data[0])));
+}
 
-            // When sending an ACK, we only need to send the ACK to the sender.
-            case NETWORK_ACK:
-            {
-                if(NULL != message->dest)
-                {
-                    net_socket.send(message->Data, message->dest->addr, message->dest->port);
-                }
-                // Transmitted the message, so remove it from the list
-                delete message;
-                transmit_queue.erase(transmit_queue.find(msg_id));
-                break;
-            }
+// Keep a received fragment, and hand over the message once every
+// fragment of it has arrived.
+void Network::reassemble(Client_t *client, const char *data, sf::Uint16 length, bool compressed)
+{
+    if(length < FRAGMENT_HEADER_SIZE)
+    {
+        return;
+    }
+    sf::Uint16 id = readUint16(&data[0]);
+    sf::Uint16 index = readUint16(&data[2]);
+    sf::Uint16 count = readUint16(&data[4]);
+    if((index >= count) ||
+       ((sf::Uint32)count * FRAGMENT_PAYLOAD_SIZE > NETWORK_MAX_MESSAGE_SIZE + FRAGMENT_PAYLOAD_SIZE))
+    {
+        return;
+    }
 
-            default:
-            {
-                // A normal message, no response needed
-                // just send to all clients, then delete the message
-                for(int i=0;i<numclients;i++)
-                {
-                    net_socket.send(message->Data, clients[i].addr, clients[i].port);
-                }
-                delete message;
-                transmit_queue.erase(transmit_queue.find(msg_id));
-                break;
-            }
-        }
-        msg_id++;
+    std::map<sf::Uint16, Reassembly_t>::iterator iter = client->reassembly.find(id);
+    if(client->reassembly.end() == iter)
+    {
+        Reassembly_t reassembly;
+        reassembly.fragments.assign(count, MESSAGE_NONE);
+        reassembly.num_received = 0u;
+        reassembly.compressed = compressed;
+        reassembly.started = getTime();
+        iter = client->reassembly.insert(std::make_pair(id, reassembly)).first;
+    }
+    Reassembly_t& reassembly = iter->second;
+    if((reassembly.fragments.size() != count) || (MESSAGE_NONE != reassembly.fragments[index]))
+    {
+        return;
     }
+    reassembly.fragments[index] = copyToPool(&data[FRAGMENT_HEADER_SIZE], length - FRAGMENT_HEADER_SIZE);
+    reassembly.num_received++;
 
-    // Any clients that still have the disconnect action
-    // are now safe to remove (i.e. no longer have pending messages)
-    for(int client_ndx = 0; client_ndx < MAX_NUM_CLIENTS; client_ndx++)
+    if(reassembly.num_received == count)
     {
-        if(clients[client_ndx].disconnect == DO_DISCONNECT)
+        std::size_t size = 0u;
+        for(sf::Uint16 i = 0; i < count; i++)
         {
-            // Reset all client information.
-            clients[client_ndx].addr = sf::IpAddress();
-            clients[client_ndx].port = 0;
-            clients[client_ndx].disconnect = DISCONNECTED;
-            while(!clients[client_ndx].receive.empty())
-            {
-                clients[client_ndx].receive.pop();
-            }
-            // Decrement the number of connected clients.
-            if(numclients > 0)
+            size += pool.getSize(reassembly.fragments[i]);
+        }
+        sf::Uint32 message = pool.acquire(size);
+        char *buffer = pool.getData(message);
+        for(sf::Uint16 i = 0; i < count; i++)
+        {
+            std::size_t fragment_size = pool.getSize(reassembly.fragments[i]);
+            memcpy(buffer, pool.getData(reassembly.fragments[i]), fragment_size);
+            buffer += fragment_size;
+        }
+        bool decompress = reassembly.compressed;
+        releaseReassembly(reassembly);
+        client->reassembly.erase(iter);
+        if(decompress)
+        {
+            sf::Uint32 compressed_message = message;
+            message = decompressToPool(pool.getData(compressed_message), size);
+            pool.release(compressed_message);
+            if(MESSAGE_NONE == message)
             {
-                numclients--;
+                return;
             }
         }
+        queueReceived(client, wholeMessage(message));
     }
 }
 
-int Network::getNumConnected( void )
+// Returns MESSAGE_NONE if the data does not decompress
+sf::Uint32 Network::decompressToPool(const char *data, std::size_t size)
 {
-    return numclients;
+    std::size_t original;
+    if((!NetCompress::getSize(data, size, original)) || (original > NETWORK_MAX_MESSAGE_SIZE))
+    {
+        return MESSAGE_NONE;
+    }
+    sf::Uint32 message = pool.acquire(original);
+    if(!NetCompress::decompress(data, size, pool.getData(message), original))
+    {
+        pool.release(message);
+        return MESSAGE_NONE;
+    }
+    return message;
 }
 
-void Network::Reset()
+void Network::releaseReassembly(Reassembly_t& reassembly)
 {
-    numclients = 0;
-    for(int i = 0; i < MAX_NUM_CLIENTS; i++)
+    for(unsigned int i = 0; i < reassembly.fragments.size(); i++)
+    {
+        if(MESSAGE_NONE != reassembly.fragments[i])
+        {
+            pool.release(reassembly.fragments[i]);
+        }
+    }
+}
+
+// Give up on messages whose missing fragments never turned up
+void Network::expireReassembly(Client_t *client, double current_time)
+{
+    std::map<sf::Uint16, Reassembly_t>::iterator iter = client->reassembly.begin();
+    while(iter != client->reassembly.end())
     {
-        clients[i].addr = sf::IpAddress();
-        clients[i].port = 0;
-        clients[i].disconnect = DISCONNECTED;
-        while(!clients[i].receive.empty())
+        if((current_time - iter->second.started) > REASSEMBLY_TIMEOUT)
+        {
+            releaseReassembly(iter->second);
+            client->reassembly.erase(iter++);
+        }
+        else
         {
-            clients[i].receive.pop();
+            iter++;
         }
     }
+}
 
-    sf::Uint32 next_msg_uid = 0;
-    while(transmit_queue.find(next_msg_uid) != transmit_queue.end())
+void Network::appendMessage(Client_t *client, sf::Packet& datagram, sf::Uint8 msg_type, sf::Uint16 msg_id, const char *data, sf::Uint16 length)
+{
+    // Start a new datagram if the message does not fit in this one
+    if((datagram.getDataSize() + MESSAGE_HEADER_SIZE + length + NETHEADER_CHECK_SIZE) > NETWORK_MTU)
     {
-        delete transmit_queue[next_msg_uid];
-        next_msg_uid++;
+        flushDatagram(client, datagram);
     }
 
-    transmit_queue.clear();
+    if(0u == datagram.getDataSize())
+    {
+        writeHeader(client, datagram);
+    }
 
-    message_timer.restart();
+    // Only these have a sequence number worth sending
+    Network_Messages_T base_type = (Network_Messages_T)(msg_type & ~NETWORK_COMPRESSED_FLAG);
+    bool has_sequence = ((NETWORK_GUARANTEED == base_type) || (NETWORK_SEQUENCED == base_type) ||
+                         (NETWORK_FRAGMENT == base_type));
+    std::size_t start = datagram.getDataSize();
+    tx_writer.appendMessage(datagram, msg_type, has_sequence, msg_id, data, length);
+    // A message after the first can have a shorter sequence number
+    framing_bytes_saved += DatagramWriter::getFirstFramingSize(has_sequence, length) -
+                           (datagram.getDataSize() - start - length);
+    messages_sent++;
+    client->stats.messages_sent++;
 }
 
-bool Network::pendingMessages()
+void Network::writeHeader(Client_t *client, sf::Packet& datagram)
+{
+    double current_time = getTime();
+    Datagram_Header_t header;
+    header.flags = 0u;
+    header.connection_id = client->connection_id;
+    header.ack = client->received->getAck();
+    header.ack_bits = client->received->getAckBits();
+    header.timestamp = 0u;
+    header.echo = 0u;
+
+    if(client->received->ackPending())
+    {
+        client->ack_repeats = NETWORK_ACK_REPEATS;
+        header.flags |= NETHEADER_ACK;
+    }
+    else if((client->ack_repeats > 0u) && (0u != header.ack_bits))
+    {
+        client->ack_repeats--;
+        header.flags |= NETHEADER_ACK;
+    }
+
+    if((current_time - client->timestamp_sent) >= NETWORK_TIMESTAMP_INTERVAL)
+    {
+        header.timestamp = getTimestamp(current_time);
+        header.flags |= NETHEADER_TIMESTAMP;
+        client->timestamp_sent = current_time;
+    }
+    if(client->echo_pending)
+    {
+        // Leave out the time the timestamp spent waiting here, so the
+        // peer only measures the time spent on the network.
+        header.echo = client->peer_timestamp +
+                      getTimestamp(current_time - client->peer_timestamp_received);
+        header.flags |= NETHEADER_ECHO;
+        client->echo_pending = false;
+    }
+    tx_writer.begin(datagram, header);
+    header_bytes_sent += datagram.getDataSize() + NETHEADER_CHECK_SIZE;
+}
+
+// Milliseconds, wrapping every 65.5 seconds
+sf::Uint16 Network::getTimestamp(double time)
 {
-    return (transmit_queue.size() > 0);
+    return (sf::Uint16)(sf::Uint32)(time * 1000.0);
 }
 
-sf::Uint16 Network::getLocalPort()
+void Network::flushDatagram(Client_t *client, sf::Packet& datagram)
 {
-    return net_socket.getLocalPort();
+    if(datagram.getDataSize() > 0u)
+    {
+        tx_writer.finish(datagram, protocol_id, client->token);
+        sendDatagram((const char *)datagram.getData(), datagram.getDataSize(), client->addr, client->port);
+        datagrams_sent++;
+        client->stats.datagrams_sent++;
+        client->stats.bytes_sent += datagram.getDataSize();
+        datagram.clear();
+        client->last_sent = getTime();
+
+        // Any outstanding acknowledgement went out with this datagram
+        client->received->ackSent();
+    }
 }
 
-void Network::disconnectClient(Client_t* player_client)
+void Network::acknowledgeMessage(Client_t *client, sf::Uint16 sequence)
 {
-    clients[findClient(player_client)].disconnect = WAIT_DISCONNECT;
+    // The window lookup is a direct index on the sequence number
+    Send_Window_Entry_t* entry = client->window->find(sequence);
+    if(NULL != entry)
+    {
+        // Only a message sent once tells how long the ACK took, and
+        // that it was not lost.  last_received is the time now.
+        if((0u == entry->NumResends) && (0.0 != entry->TimeStarted))
+        {
+            double latency = client->last_received - entry->TimeStarted;
+            client->stats.ack_latency_total += latency;
+            client->stats.ack_latency_count++;
+            if(latency > client->stats.ack_latency_max)
+            {
+                client->stats.ack_latency_max = latency;
+            }
+            client->stats.loss -= NETWORK_LOSS_GAIN * client->stats.loss;
+        }
+        client->window->acknowledge(sequence);
+
+        // Received a response, so reset send attempts.
+        client->num_send_attempts = 0u;
+    }
 }
 
-Client_t* Network::getClient( sf::Uint8 client_ndx )
+// Smoothed round trip time and variance as done by TCP (Jacobson/Karels)
+void Network::updateRtt(Client_t *client, double sample)
 {
-    Client_t* tmp_client = NULL;
-    if(client_ndx < MAX_NUM_CLIENTS)
+    unsigned int bucket = 0u;
+    sf::Uint32 ms = (sf::Uint32)(sample * 1000.0);
+    while((0u != (ms >> bucket)) && (bucket < (NETWORK_RTT_BUCKETS - 1)))
     {
-        tmp_client = &clients[client_ndx];
+        bucket++;
+    }
+    client->stats.rtt_histogram[bucket]++;
+
+    if(!client->rtt_measured)
+    {
+        client->ping = sample;
+        client->rtt_var = sample / 2.0;
+        client->rtt_measured = true;
+    }
+    else
+    {
+        double error = client->ping - sample;
+        client->rtt_var = 0.75 * client->rtt_var + 0.25 * ((error < 0.0) ? -error : error);
+        client->ping = 0.875 * client->ping + 0.125 * sample;
+    }
+
+    client->rto = client->ping + 4.0 * client->rtt_var;
+    if(client->rto < NETWORK_MIN_RTO)
+    {
+        client->rto = NETWORK_MIN_RTO;
+    }
+    else if(client->rto > NETWORK_MAX_RTO)
+    {
+        client->rto = NETWORK_MAX_RTO;
+    }
+}
+
+void Network::processAcks(Client_t *client, sf::Uint16 ack, sf::Uint32 ack_bits)
+{
+    for(sf::Uint16 n = 0; (n < ACK_BITS_SIZE) && (0u != ack_bits); n++)
+    {
+        if(ack_bits & 1u)
+        {
+            acknowledgeMessage(client, ack - n);
+        }
+        ack_bits >>= 1;
+    }
+}
+
+bool Network::sendData(sf::Packet& p, bool guaranteed)
+{
+    send(guaranteed ? NETWORK_GUARANTEED : NETWORK_NORMAL, p, NETWORK_NO_CLIENT, 0u);
+
+    return true;
+}
+
+// Send a message to a single client.  A guaranteed message is only
+// added to that client's window, so nobody else has to acknowledge it.
+bool Network::sendTo(sf::Packet& p, Client_Id_t dest, bool guaranteed)
+{
+    if(NETWORK_NO_CLIENT == dest)
+    {
+        return false;
+    }
+    return send(guaranteed ? NETWORK_GUARANTEED : NETWORK_NORMAL, p, dest, 0u);
+}
+
+// Send a message to every client that is in at least one of the groups
+// in group_mask, see setClientGroups().
+bool Network::sendToGroup(sf::Packet& p, sf::Uint32 group_mask, bool guaranteed)
+{
+    if(0u == group_mask)
+    {
+        return false;
+    }
+    return send(guaranteed ? NETWORK_GUARANTEED : NETWORK_NORMAL, p, NETWORK_NO_CLIENT, group_mask);
+}
+
+// Send a message that may be lost, and that is dropped by the receiver
+// if a newer message on the same channel has already arrived.  Used
+// for state updates where only the latest one matters.  Sent to every
+// client unless dest is given.  The messages are numbered on each
+// channel for each client, so a channel is one stream of updates from
+// sender to receiver, of whatever the caller puts on it, and not one
+// per thing being updated.  With 256 channels, updates to more things
+// than that have to share a stream, as the server's snapshots do.
+bool Network::sendSequenced(sf::Packet& p, sf::Uint8 channel, Client_Id_t dest)
+{
+    if(!threaded)
+    {
+        Client_t *client = findClientId(dest);
+        if((NETWORK_NO_CLIENT != dest) && (NULL == client))
+        {
+            return false;
+        }
+        return queueSequencedMessage((const char *)p.getData(), p.getDataSize(), channel, client);
+    }
+    Network_Command_t *command = reserveCommand();
+    if(NULL == command)
+    {
+        return false;
+    }
+    command->command = NETWORK_COMMAND_SEQUENCED;
+    command->msg_type = NETWORK_SEQUENCED;
+    command->Data.clear();
+    command->Data.append(p.getData(), p.getDataSize());
+    command->dest = dest;
+    command->groups = 0u;
+    command->channel = channel;
+    commands->commit();
+    return true;
+}
+
+bool Network::send(Network_Messages_T msg_type, sf::Packet& p, Client_Id_t dest, sf::Uint32 groups)
+{
+    if(!threaded)
+    {
+        Client_t *client = findClientId(dest);
+        if((NETWORK_NO_CLIENT != dest) && (NULL == client))
+        {
+            return false;
+        }
+        return queueTransmitMessage(msg_type, (const char *)p.getData(), p.getDataSize(), client, groups);
+    }
+    Network_Command_t *command = reserveCommand();
+    if(NULL == command)
+    {
+        return false;
+    }
+    command->command = NETWORK_COMMAND_SEND;
+    command->msg_type = msg_type;
+    command->Data.clear();
+    command->Data.append(p.getData(), p.getDataSize());
+    command->dest = dest;
+    command->groups = groups;
+    command->channel = 0u;
+    commands->commit();
+    return true;
+}
+
+bool Network::queueSequencedMessage(const char *data, std::size_t size, sf::Uint8 channel, Client_t* dest)
+{
+    // Sequenced messages are never split up
+    if((numclients == 0) || ((size + 1u) > NETWORK_MAX_PAYLOAD))
+    {
+        return false;
+    }
+    Transmit_Message_t transmit;
+    transmit.message = pool.acquire(size + 1u);
+    char *buffer = pool.getData(transmit.message);
+    buffer[0] = channel;
+    memcpy(&buffer[1], data, size);
+    transmit.msg_type = NETWORK_SEQUENCED;
+    transmit.dest = dest;
+    transmit.groups = 0u;
+
+    transmit_queue.push_back(transmit);
+    return true;
+}
+
+// Carry out a command now, or pass it to the network thread if there
+// is one.  In that case the result of the command is not known.  The
+// game thread never waits for room, a command that does not fit is
+// kept back and passed on by a later call or by Transmit().
+bool Network::submit(Network_Command_t& command)
+{
+    if(!threaded)
+    {
+        return runCommand(command);
+    }
+    submitBacklog();
+    if((!game_backlog.empty()) || (!commands->push(command)))
+    {
+        game_backlog.push_back(command);
+    }
+    return true;
+}
+
+// Pass on the commands kept back by submit(), in order
+void Network::submitBacklog()
+{
+    while((!game_backlog.empty()) && commands->push(game_backlog.front()))
+    {
+        game_backlog.pop_front();
+    }
+}
+
+// The queue entry to write a message into, for it to be passed to the
+// network thread without copying it again.  If there is no room the
+// message is dropped and counted, as the datagram could have been.
+// So are those sent while commands are kept back, which go first.
+Network_Command_t* Network::reserveCommand()
+{
+    submitBacklog();
+    Network_Command_t *command = NULL;
+    if(game_backlog.empty())
+    {
+        command = commands->reserve();
+    }
+    if(NULL == command)
+    {
+        game_dropped++;
+    }
+    return command;
+}
+
+// Messages the game thread has had to drop for want of room in the
+// queue to the network thread
+sf::Uint32 Network::getDroppedCount()
+{
+    return game_dropped;
+}
+
+bool Network::runCommand(Network_Command_t& command)
+{
+    // A client that has gone since the command was given is left alone,
+    // even if its slot has been given to someone else
+    Client_t *dest = findClientId(command.dest);
+    if((NETWORK_NO_CLIENT != command.dest) && (NULL == dest))
+    {
+        return false;
+    }
+    bool rtn = true;
+    switch(command.command)
+    {
+        case NETWORK_COMMAND_SEND:
+        {
+            rtn = queueTransmitMessage(command.msg_type, (const char *)command.Data.getData(),
+                                       command.Data.getDataSize(), dest, command.groups);
+            break;
+        }
+
+        case NETWORK_COMMAND_SEQUENCED:
+        {
+            rtn = queueSequencedMessage((const char *)command.Data.getData(), command.Data.getDataSize(),
+                                        command.channel, dest);
+            break;
+        }
+
+        case NETWORK_COMMAND_DISCONNECT:
+        {
+            if(NULL != dest)
+            {
+                dest->disconnect = WAIT_DISCONNECT;
+            }
+            break;
+        }
+
+        case NETWORK_COMMAND_GROUPS:
+        {
+            if(NULL != dest)
+            {
+                dest->groups = command.groups;
+            }
+            break;
+        }
+    }
+    return rtn;
+}
+
+Client_t* Network::addClient(const sf::IpAddress& addr, unsigned short port)
+{
+    Client_t* client = findClient(addr, port);
+    if(NULL == client)
+    {
+        // Reuse the slot of a client that has left if there is one
+        if(!free_handles.empty())
+        {
+            client = clients[free_handles.back()];
+            free_handles.pop_back();
+        }
+        else if(clients.size() < MAX_NUM_CLIENTS)
+        {
+            client = new Client_t();
+            client->handle = clients.size();
+            client->generation = 0u;
+            client->published = DISCONNECTED;
+            client->published_generation = 0u;
+            client->window = new SendWindow(&pool);
+            client->received = new ReceiveWindow();
+            clients.push_back(client);
+        }
+        else
+        {
+            // No more room
+            return NULL;
+        }
+
+        client->addr = addr;
+        client->port = port;
+        client->connection_id = is_server ? client->handle : NETWORK_NO_CONNECTION;
+        client->token = 0u;
+        client->nonce = 0u;
+        client->cookie = 0u;
+        client->have_cookie = false;
+        client->handshake_sent = 0.0;
+        client->migrate_port = 0;
+        client->migrate_challenge = 0u;
+        client->migrate_sent = -NETWORK_CONNECT_RETRY;
+        client->groups = 0u;
+        client->last_sent = getTime();
+        client->last_received = client->last_sent;
+        client->peer_timestamp = 0u;
+        client->peer_timestamp_received = 0.0;
+        client->echo_pending = false;
+        client->timestamp_sent = -NETWORK_TIMESTAMP_INTERVAL;
+        client->ack_repeats = 0u;
+        client->ping = 0.0;
+        client->rtt_var = 0.0;
+        client->rto = NETWORK_TIMEOUT;
+        client->rtt_measured = false;
+        client->timed_out = 0.0;
+        client->num_send_attempts = 0u;
+        client->receive_head = 0u;
+        memset(&client->stats, 0, sizeof(client->stats));
+        // Set that a client is now connected
+        client->disconnect = CONNECTED;
+        client_lookup.insert(addr, port, client->handle);
+        numclients++;
+    }
+    return client;
+}
+
+Client_t* Network::findClient(const sf::IpAddress& addr, unsigned short port)
+{
+    sf::Uint16 handle = client_lookup.find(addr, port);
+    return (ENDPOINT_NOT_FOUND != handle) ? clients[handle] : NULL;
+}
+
+// The client with the given id, or NULL if it has gone
+Client_t* Network::findClientId(Client_Id_t id)
+{
+    sf::Uint16 handle = NETWORK_CLIENT_HANDLE(id);
+    if((NETWORK_NO_CLIENT == id) || (handle >= clients.size()))
+    {
+        return NULL;
+    }
+    Client_t *client = clients[handle];
+    if((client->generation != NETWORK_CLIENT_GENERATION(id)) || (client->disconnect == DISCONNECTED))
+    {
+        return NULL;
+    }
+    return client;
+}
+
+// Drop the pending messages and set a timeout disconnect state
+void Network::timeOutClient(Client_t *client)
+{
+    client->window->clear();
+    // A client that is already being removed can just finish
+    // disconnecting now that it has nothing pending.
+    if(client->disconnect == CONNECTED)
+    {
+        client->disconnect = TIMEOUT_DISCONNECT;
+        client->timed_out = getTime();
+    }
+}
+
+void Network::removeClient(Client_t *client)
+{
+    // The address may have been given to a new connection already
+    if(client_lookup.find(client->addr, client->port) == client->handle)
+    {
+        client_lookup.erase(client->addr, client->port);
+    }
+
+    // Reset all client information.
+    client->addr = sf::IpAddress();
+    client->port = 0;
+    client->disconnect = DISCONNECTED;
+    client->num_send_attempts = 0u;
+    client->window->clear();
+    client->received->clear();
+    client->late_acks.clear();
+    for(std::map<sf::Uint16, Reassembly_t>::iterator iter = client->reassembly.begin();
+        iter != client->reassembly.end(); iter++)
+    {
+        releaseReassembly(iter->second);
+    }
+    client->reassembly.clear();
+    while(!client->receive.empty())
+    {
+        pool.release(client->receive.front().message);
+        client->receive.pop_front();
+    }
+    client->sequenced.clear();
+    client->sequenced_next.clear();
+    // Ids given out for the client no longer refer to the slot
+    client->generation++;
+    free_handles.push_back(client->handle);
+
+    // Decrement the number of connected clients.
+    if(numclients > 0)
+    {
+        numclients--;
+    }
+}
+
+#ifdef NETWORK_USE_MMSG
+void Network::initBatches()
+{
+    batched_io = true;
+    tx_count = 0u;
+    memset(tx_msgs, 0, sizeof(tx_msgs));
+    memset(rx_msgs, 0, sizeof(rx_msgs));
+    for(int i = 0; i < NETWORK_BATCH_SIZE; i++)
+    {
+        tx_iov[i].iov_base = tx_buff[i];
+        tx_msgs[i].msg_hdr.msg_iov = &tx_iov[i];
+        tx_msgs[i].msg_hdr.msg_iovlen = 1;
+        tx_msgs[i].msg_hdr.msg_name = &tx_addr[i];
+        tx_msgs[i].msg_hdr.msg_namelen = sizeof(tx_addr[i]);
+
+        rx_iov[i].iov_base = pool.getData(rx_messages[i]);
+        rx_iov[i].iov_len = RECEIVE_BUFFER_SIZE;
+        rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+        rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        rx_msgs[i].msg_hdr.msg_name = &rx_addr[i];
+    }
+}
+#endif
+
+void Network::sendDatagram(const char *data, std::size_t size, const sf::IpAddress& addr, unsigned short port)
+{
+    if(sim_out.enabled())
+    {
+        // Sent once the simulated link lets it through
+        sim_out.push(data, size, addr, port, getTime());
+    }
+    else
+    {
+        sendToSocket(data, size, addr, port);
+    }
+}
+
+void Network::sendToSocket(const char *data, std::size_t size, const sf::IpAddress& addr, unsigned short port)
+{
+    if(capture.isOpen())
+    {
+        capture.record(NETCAPTURE_SENT, getTime() - capture_start, data, size, addr, port);
+    }
+    if(replaying)
+    {
+        // There is nobody on the other end
+        return;
+    }
+#ifdef NETWORK_USE_MMSG
+    if(batched_io && (size <= NETWORK_MTU))
+    {
+        // Copy into the next free slot, the batch goes out in one call
+        // once it is full or at the end of Transmit().
+        memcpy(tx_buff[tx_count], data, size);
+        tx_iov[tx_count].iov_len = size;
+        memset(&tx_addr[tx_count], 0, sizeof(tx_addr[tx_count]));
+        tx_addr[tx_count].sin_family = AF_INET;
+        tx_addr[tx_count].sin_port = htons(port);
+        tx_addr[tx_count].sin_addr.s_addr = htonl(addr.toInteger());
+        tx_count++;
+        if(NETWORK_BATCH_SIZE == tx_count)
+        {
+            flushSendBatch();
+        }
+        return;
+    }
+#endif
+    net_socket.send(data, size, addr, port);
+}
+
+/*
+ * Turn the batched calls off, or back on, after Create() and before the
+ * network thread is started.  Without NETWORK_USE_MMSG there are none to
+ * turn on, and on a kernel without them they turn themselves off again
+ * the first time they are used.
+ */
+void Network::setBatchedIo(bool enabled)
+{
+#ifdef NETWORK_USE_MMSG
+    flushSendBatch();
+    batched_io = enabled;
+#endif
+}
+
+bool Network::isBatchedIo()
+{
+#ifdef NETWORK_USE_MMSG
+    return batched_io;
+#else
+    return false;
+#endif
+}
+
+void Network::flushSendBatch()
+{
+#ifdef NETWORK_USE_MMSG
+    unsigned int sent = 0u;
+    while(sent < tx_count)
+    {
+        int rc = sendmmsg(net_socket.getSocketHandle(), &tx_msgs[sent], tx_count - sent, 0);
+        if(rc > 0)
+        {
+            sent += rc;
+        }
+        else if((rc < 0) && (ENOSYS == errno))
+        {
+            // No kernel support, send the rest one at a time from now on
+            batched_io = false;
+            for(; sent < tx_count; sent++)
+            {
+                net_socket.send(tx_buff[sent], tx_iov[sent].iov_len,
+                                sf::IpAddress(ntohl(tx_addr[sent].sin_addr.s_addr)),
+                                ntohs(tx_addr[sent].sin_port));
+            }
+        }
+        else
+        {
+            // Drop the datagram that could not be sent, just as an
+            // unsuccessful sf::UdpSocket::send() would.
+            sent++;
+        }
+    }
+    tx_count = 0u;
+#endif
+}
+
+void Network::Receive()
+{
+    // The network thread does this by itself
+    if(!threaded)
+    {
+        receiveNow();
+    }
+}
+
+void Network::receiveNow()
+{
+    // Get any received packets
+    sf::IpAddress addr;
+    unsigned short port;
+    std::size_t received;
+
+    if(replaying)
+    {
+        receiveReplay();
+        return;
+    }
+
+#ifdef NETWORK_USE_MMSG
+    while(batched_io)
+    {
+        for(int i = 0; i < NETWORK_BATCH_SIZE; i++)
+        {
+            rx_msgs[i].msg_hdr.msg_namelen = sizeof(rx_addr[i]);
+        }
+        int rc = recvmmsg(net_socket.getSocketHandle(), rx_msgs, NETWORK_BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if((rc < 0) && (ENOSYS == errno))
+        {
+            batched_io = false;
+            break;
+        }
+        for(int i = 0; i < rc; i++)
+        {
+            receiveDatagram(rx_messages[i], rx_msgs[i].msg_len,
+                            sf::IpAddress(ntohl(rx_addr[i].sin_addr.s_addr)),
+                            ntohs(rx_addr[i].sin_port));
+            rx_iov[i].iov_base = pool.getData(rx_messages[i]);
+        }
+        if(rc < NETWORK_BATCH_SIZE)
+        {
+            // The socket has been drained
+            break;
+        }
+    }
+
+    if(!batched_io)
+#endif
+    {
+        // Receive any packets from the server
+        while(net_socket.receive(pool.getData(rx_messages[0]), RECEIVE_BUFFER_SIZE, received, addr, port) == sf::Socket::Done)
+        {
+            receiveDatagram(rx_messages[0], received, addr, port);
+        }
+    }
+
+    // Handle the simulated arrivals that are now due
+    double current_time = getTime();
+    while(sim_in.pop(current_time, sim_buff, addr, port))
+    {
+        processDatagram(&sim_buff[0], sim_buff.size(), addr, port);
+    }
+}
+
+/*
+ * Handle a datagram received into one of the pooled receive buffers.
+ * Messages that are handed over as they are keep a reference to the
+ * buffer, rather than being copied out of it, so if any did the buffer
+ * is swapped for a fresh one.
+ */
+void Network::receiveDatagram(sf::Uint32& buffer, std::size_t size, const sf::IpAddress& addr, unsigned short port)
+{
+    const char *data = pool.getData(buffer);
+    if(sim_in.enabled())
+    {
+        // Handled once the simulated link delivers it
+        sim_in.push(data, size, addr, port, getTime());
+    }
+    else
+    {
+        rx_message = buffer;
+        processDatagram(data, size, addr, port);
+        rx_message = MESSAGE_NONE;
+        // Straight back off the free list if nothing kept it
+        pool.release(buffer);
+        buffer = pool.acquire(RECEIVE_BUFFER_SIZE);
+    }
+}
+
+void Network::processDatagram(const char *data, std::size_t size, const sf::IpAddress& addr, unsigned short port)
+{
+    if(capture.isOpen())
+    {
+        capture.record(NETCAPTURE_RECEIVED, getTime() - capture_start, data, size, addr, port);
+    }
+    DatagramReader reader(data, size);
+    Datagram_Header_t header;
+    if(!reader.readHeader(header))
+    {
+        return;
+    }
+    sf::Uint8 message_type;
+    sf::Uint16 msg_id;
+    const char *payload;
+    sf::Uint16 length;
+    if(NETWORK_NO_CONNECTION == header.connection_id)
+    {
+        if(reader.check(protocol_id, 0u) && reader.readMessage(message_type, msg_id, payload, length))
+        {
+            processHandshake(message_type, payload, length, addr, port);
+        }
+        return;
+    }
+
+    Client_t* client = findConnection(header.connection_id, reader);
+    if(NULL == client)
+    {
+        // Not from a connected client
+        return;
+    }
+    if(is_server && ((client->addr != addr) || (client->port != port)))
+    {
+        checkMigration(client, reader, addr, port);
+        return;
+    }
+
+    double current_time = getTime();
+    client->last_received = current_time;
+    client->stats.datagrams_received++;
+    client->stats.bytes_received += size;
+
+    // Datagrams acknowledge the guaranteed messages the sender has
+    // received from us.
+    if(header.flags & NETHEADER_ACK)
+    {
+        processAcks(client, header.ack, header.ack_bits);
+    }
+
+    // and echo the time of a datagram we sent it
+    if(header.flags & NETHEADER_ECHO)
+    {
+        sf::Uint16 rtt = getTimestamp(current_time) - header.echo;
+        // Anything longer is left over from before the clock wrapped
+        if(rtt < (sf::Uint16)(NETWORK_RECEIVE_TIMEOUT * 1000.0))
+        {
+            updateRtt(client, rtt / 1000.0);
+        }
+    }
+    if(header.flags & NETHEADER_TIMESTAMP)
+    {
+        client->peer_timestamp = header.timestamp;
+        client->peer_timestamp_received = current_time;
+        client->echo_pending = true;
+    }
+
+    // Split the datagram back into the messages it carries
+    while(reader.readMessage(message_type, msg_id, payload, length))
+    {
+        processMessage(client, message_type, msg_id, payload, length);
+        client->stats.messages_received++;
+    }
+}
+
+// Find the client a datagram is from by its connection id, wherever
+// the datagram came from
+Client_t* Network::findConnection(sf::Uint16 connection_id, DatagramReader& reader)
+{
+    Client_t* client = NULL;
+    if(is_server)
+    {
+        if(connection_id < clients.size())
+        {
+            client = clients[connection_id];
+        }
+    }
+    else if(!clients.empty())
+    {
+        client = clients[0];
+    }
+
+    if((NULL == client) || (client->disconnect == DISCONNECTED) ||
+       (client->disconnect == CONNECTING) ||
+       (client->connection_id != connection_id) ||
+       (!reader.check(protocol_id, client->token) && !replaying))
+    {
+        return NULL;
+    }
+    return client;
+}
+
+/*
+ * A datagram that passed the check for a client has come from another
+ * address.  Only the answer to a challenge sent to that address is
+ * looked at, see NETWORK_MIGRATE, and once it is right the client is
+ * moved there.  Otherwise a challenge goes out to the address.
+ */
+void Network::checkMigration(Client_t *client, DatagramReader& reader, const sf::IpAddress& addr, unsigned short port)
+{
+    double current_time = getTime();
+    bool pending = (0u != client->migrate_challenge) &&
+                   (client->migrate_addr == addr) && (client->migrate_port == port);
+    sf::Uint8 message_type;
+    sf::Uint16 msg_id;
+    const char *payload;
+    sf::Uint16 length;
+    while(pending && reader.readMessage(message_type, msg_id, payload, length))
+    {
+        if((NETWORK_MIGRATE == message_type) && (length >= 8u) &&
+           ((readUint32(&payload[0]) == client->migrate_challenge) || replaying))
+        {
+            if((readUint32(&payload[4]) == makeMigrateProof(client->nonce, client->migrate_challenge)) || replaying)
+            {
+                if(client_lookup.find(client->addr, client->port) == client->handle)
+                {
+                    client_lookup.erase(client->addr, client->port);
+                }
+                client->addr = addr;
+                client->port = port;
+                client_lookup.insert(addr, port, client->handle);
+                client->last_received = current_time;
+            }
+            client->migrate_challenge = 0u;
+            return;
+        }
+    }
+
+    if((current_time - client->migrate_sent) >= NETWORK_CONNECT_RETRY)
+    {
+        if(!pending)
+        {
+            client->migrate_addr = addr;
+            client->migrate_port = port;
+            // Zero means there is no challenge
+            client->migrate_challenge = random() | 1u;
+        }
+        sendMigrate(client);
+        client->migrate_sent = current_time;
+    }
+}
+
+// The challenge goes in a datagram of its own to the new address
+void Network::sendMigrate(Client_t *client)
+{
+    sf::Packet datagram;
+    sf::Packet challenge;
+    DatagramWriter writer;
+    Datagram_Header_t header;
+    header.flags = 0u;
+    header.connection_id = client->connection_id;
+    challenge << client->migrate_challenge;
+    writer.begin(datagram, header);
+    writer.appendMessage(datagram, (sf::Uint8)NETWORK_MIGRATE, false, 0u,
+                         (const char *)challenge.getData(), challenge.getDataSize());
+    writer.finish(datagram, protocol_id, client->token);
+    sendDatagram((const char *)datagram.getData(), datagram.getDataSize(), client->migrate_addr, client->migrate_port);
+}
+
+// Only the two ends of a connection know the nonce of its handshake
+sf::Uint32 Network::makeMigrateProof(sf::Uint32 nonce, sf::Uint32 challenge)
+{
+    sf::Uint32 values[2] = {nonce, challenge};
+    sf::Uint32 hash = 2166136261u;
+    for(int i = 0; i < 2; i++)
+    {
+        for(int b = 0; b < 4; b++)
+        {
+            hash ^= (values[i] >> (b * 8)) & 0xFFu;
+            hash *= 16777619u;
+        }
+    }
+    return hash;
+}
+
+void Network::processHandshake(sf::Uint8 msg_type, const char *data, sf::Uint16 length, const sf::IpAddress& addr, unsigned short port)
+{
+    if(length < 4u)
+    {
+        return;
+    }
+    sf::Uint32 nonce = readUint32(&data[0]);
+
+    if(is_server)
+    {
+        // A client already set up for this address is either repeating
+        // a step whose answer was lost, or has started over.  Anyone can
+        // claim to have started over, so the old connection is left alone
+        // until the new one has answered the challenge.
+        Client_t* client = findClient(addr, port);
+        if((NULL != client) && (client->nonce == nonce) && (client->disconnect == CONNECTED))
+        {
+            sendAccept(client);
+        }
+        else if(NETWORK_CONNECT == msg_type)
+        {
+            sf::Packet challenge;
+            challenge << nonce;
+            challenge << makeCookie(addr, port, nonce);
+            sendHandshake(NETWORK_CHALLENGE, challenge, addr, port);
+        }
+        else if((NETWORK_RESPONSE == msg_type) && (length >= 8u) &&
+                ((readUint32(&data[4]) == makeCookie(addr, port, nonce)) || replaying))
+        {
+            // The new connection can receive at the address, so the old
+            // one is dead.  Time it out, for the game to see, and give the
+            // address to the new one.
+            if(NULL != client)
+            {
+                timeOutClient(client);
+                client_lookup.erase(addr, port);
+            }
+            client = addClient(addr, port);
+            if(NULL != client)
+            {
+                client->nonce = nonce;
+                client->token = random();
+                sendAccept(client);
+            }
+        }
+    }
+    else if(!clients.empty() && (clients[0]->disconnect == CONNECTING) &&
+            (clients[0]->nonce == nonce) &&
+            (clients[0]->addr == addr) && (clients[0]->port == port))
+    {
+        Client_t* server = clients[0];
+        if((NETWORK_CHALLENGE == msg_type) && (length >= 8u) && !server->have_cookie)
+        {
+            // Answer straight away
+            server->cookie = readUint32(&data[4]);
+            server->have_cookie = true;
+            server->handshake_sent = -NETWORK_CONNECT_RETRY;
+        }
+        else if((NETWORK_ACCEPT == msg_type) && (length >= 8u))
+        {
+            server->connection_id = readUint16(&data[4]);
+            server->token = readUint16(&data[6]);
+            server->disconnect = CONNECTED;
+            server->last_received = getTime();
+        }
+    }
+}
+
+void Network::sendAccept(Client_t *client)
+{
+    sf::Packet accept;
+    accept << client->nonce;
+    accept << client->connection_id;
+    accept << client->token;
+    sendHandshake(NETWORK_ACCEPT, accept, client->addr, client->port);
+}
+
+// Handshake messages go in a datagram of their own
+void Network::sendHandshake(sf::Uint8 msg_type, sf::Packet& p, const sf::IpAddress& addr, unsigned short port)
+{
+    sf::Packet datagram;
+    DatagramWriter writer;
+    Datagram_Header_t header;
+    header.flags = 0u;
+    header.connection_id = NETWORK_NO_CONNECTION;
+    writer.begin(datagram, header);
+    writer.appendMessage(datagram, msg_type, false, 0u, (const char *)p.getData(), p.getDataSize());
+    writer.finish(datagram, protocol_id, 0u);
+    sendDatagram((const char *)datagram.getData(), datagram.getDataSize(), addr, port);
+}
+
+// Only the server can produce the cookie for a given address and nonce
+sf::Uint32 Network::makeCookie(const sf::IpAddress& addr, unsigned short port, sf::Uint32 nonce)
+{
+    // FNV-1a over the secret, address, port and nonce
+    sf::Uint32 values[4] = {secret, addr.toInteger(), port, nonce};
+    sf::Uint32 hash = 2166136261u;
+    for(int i = 0; i < 4; i++)
+    {
+        for(int b = 0; b < 4; b++)
+        {
+            hash ^= (values[i] >> (b * 8)) & 0xFFu;
+            hash *= 16777619u;
+        }
+    }
+    return hash;
+}
+
+// xorshift, for nonces and tokens
+sf::Uint32 Network::random()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+void Network::processMessage(Client_t *client, sf::Uint8 msg_type, sf::Uint16 msg_id, const char *data, sf::Uint16 length)
+{
+    bool compressed = (0u != (msg_type & NETWORK_COMPRESSED_FLAG));
+    msg_type &= ~NETWORK_COMPRESSED_FLAG;
+    switch((Network_Messages_T)msg_type)
+    {
+        case NETWORK_CONNECT:
+        {
+            break;
+        }
+        case NETWORK_DISCONNECT:
+        {
+            break;
+        }
+        case NETWORK_MIGRATE:
+        {
+            // The server has seen us at a new address, and wants to know
+            // it is really us.  The answer goes back from the same place.
+            if((!is_server) && (length >= 4u))
+            {
+                sf::Packet answer;
+                sf::Uint32 challenge = readUint32(&data[0]);
+                answer << challenge;
+                answer << makeMigrateProof(client->nonce, challenge);
+                queueTransmitMessage(NETWORK_MIGRATE, (const char *)answer.getData(), answer.getDataSize(), client, 0u);
+            }
+            break;
+        }
+
+        case NETWORK_ACK:
+        {
+            // Explicit acknowledgements for messages that are
+            // too old to fit in the ACK bitfield.
+            for(sf::Uint16 i = 0; (i + 2u) <= length; i += 2u)
+            {
+                acknowledgeMessage(client, readUint16(&data[i]));
+            }
+            break;
+        }
+
+        case NETWORK_NORMAL:
+        {
+            // Handle any remaining data in the packet
+            queueReceived(client, keepReceived(data, length));
+            break;
+        }
+
+        case NETWORK_SEQUENCED:
+        {
+            queueSequenced(client, msg_id, data, length);
+            break;
+        }
+
+        case NETWORK_GUARANTEED:
+        case NETWORK_FRAGMENT:
+        {
+            if((NETWORK_FRAGMENT == msg_type) && !canReassemble(client, msg_id, data, length))
+            {
+                break;
+            }
+            // Only hand over the first copy of a re-sent message,
+            // the acknowledgement goes out with the next datagram.
+            if(client->received->receive(msg_id, client->late_acks))
+            {
+                if(NETWORK_GUARANTEED == msg_type)
+                {
+                    if(!compressed)
+                    {
+                        queueReceived(client, keepReceived(data, length));
+                    }
+                    else
+                    {
+                        sf::Uint32 message = decompressToPool(data, length);
+                        if(MESSAGE_NONE != message)
+                        {
+                            queueReceived(client, wholeMessage(message));
+                        }
+                    }
+                }
+                else if(NETWORK_FRAGMENT == msg_type)
+                {
+                    reassemble(client, data, length, compressed);
+                }
+            }
+            break;
+        }
+
+        // Nothing to do
+        default:
+            break;
+    }
+}
+
+void Network::Transmit()
+{
+    // The network thread does this by itself
+    if(!threaded)
+    {
+        transmitNow();
+    }
+    else
+    {
+        submitBacklog();
+    }
+}
+
+void Network::transmitNow()
+{
+    // Broadcast the mesages to all clients
+    double current_time = getTime();
+
+    // Set any clients waiting to be removed to the
+    // do removal state.  This will get changed in the
+    // Transmit loop below if there are any pending messages
+    for(unsigned int client_ndx = 0; client_ndx < clients.size(); client_ndx++)
+    {
+        if(clients[client_ndx]->disconnect == WAIT_DISCONNECT)
+        {
+            clients[client_ndx]->disconnect = DO_DISCONNECT;
+        }
+        // Nothing has disconnected a client that timed out, it may
+        // never have joined the game, so free the slot anyway.
+        else if((clients[client_ndx]->disconnect == TIMEOUT_DISCONNECT) &&
+                ((current_time - clients[client_ndx]->timed_out) >= NETWORK_TIMEOUT_REMOVE))
+        {
+            clients[client_ndx]->disconnect = DO_DISCONNECT;
+        }
+    }
+
+    // Pack everything pending for each client into as few
+    // datagrams as possible.
+    for(unsigned int client_ndx = 0; client_ndx < clients.size(); client_ndx++)
+    {
+        Client_t* client = clients[client_ndx];
+        // Reused for every datagram, so its memory is only allocated once
+        sf::Packet& datagram = tx_datagram;
+        bool timed_out = false;
+        unsigned int fragments_sent = 0u;
+        if(client->disconnect == DISCONNECTED)
+        {
+            continue;
+        }
+        if(client->disconnect == CONNECTING)
+        {
+            // Nothing else goes out until the server has accepted us
+            if((current_time - client->handshake_sent) >= NETWORK_CONNECT_RETRY)
+            {
+                sf::Packet handshake;
+                handshake << client->nonce;
+                if(client->have_cookie)
+                {
+                    handshake << client->cookie;
+                }
+                sendHandshake(client->have_cookie ? NETWORK_RESPONSE : NETWORK_CONNECT,
+                              handshake, client->addr, client->port);
+                client->handshake_sent = current_time;
+            }
+            continue;
+        }
+        expireReassembly(client, current_time);
+
+        // The client has gone quiet, even the keepalives have stopped
+        if((current_time - client->last_received) > NETWORK_RECEIVE_TIMEOUT)
+        {
+            timed_out = true;
+        }
+
+        // Send any new guaranteed messages, and re-send any that have
+        // not been acknowledged within the timeout.
+        for(sf::Uint16 seq = client->window->getOldest(); seq != client->window->getNext(); seq++)
+        {
+            Send_Window_Entry_t* entry = client->window->find(seq);
+            if(NULL == entry)
+            {
+                // Already acknowledged
+                continue;
+            }
+
+            if(0.0 == entry->TimeStarted)
+            {
+                // Pace out the pieces of large messages
+                if(NETWORK_FRAGMENT == (entry->msg_type & ~NETWORK_COMPRESSED_FLAG))
+                {
+                    if(fragments_sent >= NETWORK_FRAGMENT_BURST)
+                    {
+                        continue;
+                    }
+                    fragments_sent++;
+                }
+
+                // The message has not yet been sent
+                appendMessage(client, datagram, entry->msg_type, entry->sequence,
+                              pool.getData(entry->message), pool.getSize(entry->message));
+                entry->TimeStarted = current_time;
+                entry->TimeSent = current_time;
+                client->stats.guaranteed_sent++;
+            }
+            else
+            {
+                // Back off the timeout each time the message is re-sent
+                double timeout = client->rto * (1u << entry->NumResends);
+                if(timeout > NETWORK_MAX_RTO)
+                {
+                    timeout = NETWORK_MAX_RTO;
+                }
+
+                if((current_time - entry->TimeSent) >= timeout)
+                {
+                    // Keep track of the number of attempts
+                    // if the number of attempts is exceeded the client
+                    // has stopped responding.
+                    if(MAX_NUM_SEND_ATTEMPTS <= entry->NumResends)
+                    {
+                        timed_out = true;
+                        break;
+                    }
+
+                    // Resend the message to the client
+                    appendMessage(client, datagram, entry->msg_type, entry->sequence,
+                                  pool.getData(entry->message), pool.getSize(entry->message));
+                    entry->TimeSent = current_time;
+                    entry->NumResends++;
+                    client->stats.resends++;
+                    client->stats.loss += NETWORK_LOSS_GAIN * (1.0 - client->stats.loss);
+                    if(entry->NumResends > client->num_send_attempts)
+                    {
+                        client->num_send_attempts = entry->NumResends;
+                    }
+                }
+            }
+        }
+
+        // Add any messages that do not require a response
+        for(unsigned int i = 0; i < transmit_queue.size(); i++)
+        {
+            if(isRecipient(client, transmit_queue[i].dest, transmit_queue[i].groups))
+            {
+                const char *data = pool.getData(transmit_queue[i].message);
+                sf::Uint16 sequence = 0u;
+                if(NETWORK_SEQUENCED == transmit_queue[i].msg_type)
+                {
+                    // Numbered for each client, so every one of them sees
+                    // its own messages on the channel one after another
+                    sequence = client->sequenced_next[(sf::Uint8)data[0]]++;
+                }
+                appendMessage(client, datagram, (sf::Uint8)transmit_queue[i].msg_type, sequence,
+                              data, pool.getSize(transmit_queue[i].message));
+            }
+        }
+
+        // Keep an idle link alive, and the peer's round trip time fresh
+        if((client->disconnect == CONNECTED) && (0u == datagram.getDataSize()) &&
+           ((current_time - client->last_sent) >= NETWORK_KEEPALIVE_INTERVAL))
+        {
+            appendMessage(client, datagram, (sf::Uint8)NETWORK_PING, 0u, NULL, 0u);
+        }
+
+        if(timed_out)
+        {
+            timeOutClient(client);
+        }
+
+        // There are still pending messages for this client
+        // Move back to wait state.
+        if((client->disconnect == DO_DISCONNECT) && client->window->pending())
+        {
+            client->disconnect = WAIT_DISCONNECT;
+        }
+
+        // Nothing was sent to carry the acknowledgements, or some are too
+        // old for the bitfield, so add an explicit ACK message.
+        if((client->received->ackPending() && (0u == datagram.getDataSize())) ||
+           !client->late_acks.empty())
+        {
+            sf::Packet late;
+            for(unsigned int i = 0; i < client->late_acks.size(); i++)
+            {
+                if((late.getDataSize() + sizeof(sf::Uint16)) > NETWORK_MAX_PAYLOAD)
+                {
+                    appendMessage(client, datagram, (sf::Uint8)NETWORK_ACK, 0u,
+                                  (const char *)late.getData(), late.getDataSize());
+                    late.clear();
+                }
+                late << client->late_acks[i];
+            }
+            client->late_acks.clear();
+            appendMessage(client, datagram, (sf::Uint8)NETWORK_ACK, 0u,
+                          (const char *)late.getData(), late.getDataSize());
+        }
+
+        flushDatagram(client, datagram);
+    }
+    for(unsigned int i = 0; i < transmit_queue.size(); i++)
+    {
+        pool.release(transmit_queue[i].message);
+    }
+    transmit_queue.clear();
+    capture.flush();
+
+    // Put out anything the simulated link has now let through
+    sf::IpAddress addr;
+    unsigned short port;
+    while(sim_out.pop(current_time, sim_buff, addr, port))
+    {
+        sendToSocket(&sim_buff[0], sim_buff.size(), addr, port);
+    }
+    flushSendBatch();
+
+    // Any clients that still have the disconnect action
+    // are now safe to remove (i.e. no longer have pending messages)
+    for(unsigned int client_ndx = 0; client_ndx < clients.size(); client_ndx++)
+    {
+        if(clients[client_ndx]->disconnect == DO_DISCONNECT)
+        {
+            removeClient(clients[client_ndx]);
+        }
+    }
+}
+
+int Network::getNumConnected( void )
+{
+    if(threaded)
+    {
+        return __atomic_load_n(&io_numclients, __ATOMIC_ACQUIRE);
+    }
+    return numclients;
+}
+
+void Network::Reset()
+{
+    stopThread();
+    commands = NULL;
+    delivered = NULL;
+    published_stats = NULL;
+    game_clients.clear();
+    memset(&game_totals, 0, sizeof(game_totals));
+    stats_published = 0.0;
+    stats_next = 0u;
+    numclients = 0;
+    for(unsigned int i = 0; i < clients.size(); i++)
+    {
+        delete clients[i];
+    }
+    clients.clear();
+    free_handles.clear();
+    client_lookup.clear();
+    ready_clients.clear();
+
+    // Everything still holding a message has gone
+    transmit_queue.clear();
+    pool.clear();
+    next_fragmented = 0u;
+    sim_out.clear();
+    sim_in.clear();
+    capture.close();
+    replaying = false;
+    replay_have_next = false;
+    messages_sent = 0u;
+    datagrams_sent = 0u;
+    header_bytes_sent = 0u;
+    framing_bytes_saved = 0u;
+    memset(&compress_stats, 0, sizeof(compress_stats));
+
+    message_timer.restart();
+}
+
+bool Network::pendingMessages()
+{
+    if(threaded)
+    {
+        return (!game_backlog.empty()) || (!commands->empty()) ||
+               (0u != __atomic_load_n(&io_pending, __ATOMIC_ACQUIRE));
+    }
+    return hasPending();
+}
+
+bool Network::hasPending()
+{
+    bool pending = (transmit_queue.size() > 0) || sim_out.pending() || sim_in.pending();
+    for(unsigned int i = 0; (i < clients.size()) && !pending; i++)
+    {
+        pending = clients[i]->window->pending();
+    }
+    return pending;
+}
+
+sf::Uint16 Network::getLocalPort()
+{
+    return net_socket.getLocalPort();
+}
+
+// For callers that want to wait on the socket themselves
+sf::SocketHandle Network::getSocketHandle()
+{
+    return net_socket.getSocketHandle();
+}
+
+// Readable once the network thread has passed messages or client state
+// changes over since the handle was last read, -1 if there is none.
+int Network::getWakeHandle()
+{
+    return wake_fd;
+}
+
+void Network::disconnectClient(Client_Id_t player_client)
+{
+    Network_Command_t command;
+    command.command = NETWORK_COMMAND_DISCONNECT;
+    command.msg_type = NETWORK_NONE;
+    command.dest = player_client;
+    command.groups = 0u;
+    command.channel = 0u;
+    submit(command);
+}
+
+// Number of times the message pool has had to allocate memory, which
+// stops going up once it has grown to fit the traffic.
+sf::Uint32 Network::getAllocationCount()
+{
+    if(threaded)
+    {
+        takeStats();
+        return game_totals.allocations;
+    }
+    return pool.getAllocations();
+}
+
+Coalesce_Stats_t Network::getCoalesceStats()
+{
+    if(threaded)
+    {
+        takeStats();
+        return game_totals.coalesce;
+    }
+    return makeCoalesceStats();
+}
+
+Compression_Stats_t Network::getCompressionStats()
+{
+    if(threaded)
+    {
+        takeStats();
+        return game_totals.compression;
+    }
+    return compress_stats;
+}
+
+Coalesce_Stats_t Network::makeCoalesceStats()
+{
+    Coalesce_Stats_t stats;
+    stats.messages_sent = messages_sent;
+    stats.datagrams_sent = datagrams_sent;
+    // Each message beyond the first in a datagram saves a datagram
+    // header, of the average size of the ones sent, and whatever its
+    // framing saved on the sequence number.  Every message would have
+    // needed its framing anyway.
+    double header_size = (datagrams_sent > 0u) ? ((double)header_bytes_sent / datagrams_sent) : 0.0;
+    stats.bytes_saved = (sf::Int32)((messages_sent - datagrams_sent) * (UDP_IP_HEADER_SIZE + header_size)) +
+                        (sf::Int32)framing_bytes_saved;
+    return stats;
+}
+
+/*
+ * Copy the counters kept for a connection.  Recording them is only a
+ * few additions per datagram, so this is cheap enough to call every
+ * tick.  With the network thread running the copy is the one it last
+ * passed over, at most NETWORK_STATS_INTERVAL old, and there is none
+ * until the first one has been.
+ */
+bool Network::getConnectionStats(Client_Id_t client, Connection_Stats_t& stats)
+{
+    if(threaded)
+    {
+        takeStats();
+        sf::Uint16 handle = NETWORK_CLIENT_HANDLE(client);
+        if((NETWORK_NO_CLIENT == client) || (handle >= game_clients.size()) ||
+           (game_clients[handle].generation != NETWORK_CLIENT_GENERATION(client)) ||
+           (game_clients[handle].disconnect == DISCONNECTED) || !game_clients[handle].have_stats)
+        {
+            return false;
+        }
+        stats = game_clients[handle].stats;
+        return true;
+    }
+    Client_t *tmp_client = findClientId(client);
+    if(NULL == tmp_client)
+    {
+        return false;
+    }
+    fillConnectionStats(tmp_client, stats);
+    return true;
+}
+
+void Network::fillConnectionStats(Client_t *client, Connection_Stats_t& stats)
+{
+    stats = client->stats;
+    stats.rtt = client->ping;
+    stats.rtt_var = client->rtt_var;
+    stats.send_queue = client->window->getInFlight() + client->window->getBacklog();
+    stats.receive_queue = client->receive.size();
+}
+
+// Round trip time in seconds that the given fraction of the samples
+// were under, to the resolution of the histogram buckets.
+double Network::getRttPercentile(const Connection_Stats_t& stats, double fraction)
+{
+    sf::Uint32 total = 0u;
+    for(int i = 0; i < NETWORK_RTT_BUCKETS; i++)
+    {
+        total += stats.rtt_histogram[i];
+    }
+    if(0u == total)
+    {
+        return 0.0;
+    }
+    sf::Uint32 count = 0u;
+    int bucket = 0;
+    for(; bucket < (NETWORK_RTT_BUCKETS - 1); bucket++)
+    {
+        count += stats.rtt_histogram[bucket];
+        if(count >= (fraction * total))
+        {
+            break;
+        }
+    }
+    return (1u << bucket) / 1000.0;
+}
+
+/*
+ * Pass all datagrams sent and received through a simulated link with
+ * the given conditions, in each direction.  Only one end of a
+ * connection needs it.
+ */
+void Network::setNetSim(const NetSim_Config_t& config)
+{
+    sim_out.configure(config);
+    // Use a different sequence of conditions for the other direction
+    NetSim_Config_t in_config = config;
+    in_config.seed = config.seed * 2654435761u + 1u;
+    sim_in.configure(in_config);
+}
+
+// The network's own record of a client, which belongs to the network
+// thread while it runs, so there is none to be had then.
+Client_t* Network::getClient( Client_Id_t client )
+{
+    if(threaded)
+    {
+        return NULL;
+    }
+    return findClientId(client);
+}
+
+// DISCONNECTED for a client that has gone, even if its slot has been
+// given to a new one.  With the network thread running this is the
+// state as of the last message taken from getData() or getMessage().
+Disconnect_States_t Network::getClientState(Client_Id_t client)
+{
+    sf::Uint16 handle = NETWORK_CLIENT_HANDLE(client);
+    if(threaded)
+    {
+        if((NETWORK_NO_CLIENT == client) || (handle >= game_clients.size()) ||
+           (game_clients[handle].generation != NETWORK_CLIENT_GENERATION(client)))
+        {
+            return DISCONNECTED;
+        }
+        return game_clients[handle].disconnect;
+    }
+    Client_t *tmp_client = findClientId(client);
+    return (NULL != tmp_client) ? tmp_client->disconnect : DISCONNECTED;
+}
+
+// Set the groups a client belongs to, as a bit mask of up to 32 groups
+// that the application gives its own meaning to.
+void Network::setClientGroups(Client_Id_t client, sf::Uint32 groups)
+{
+    Network_Command_t command;
+    command.command = NETWORK_COMMAND_GROUPS;
+    command.msg_type = NETWORK_NONE;
+    command.dest = client;
+    command.groups = groups;
+    command.channel = 0u;
+    submit(command);
+}
+
+// Seconds on the network clock, which a fast replay moves on by itself
+double Network::getTime()
+{
+    if(replaying && replay_fast)
+    {
+        return replay_time;
+    }
+    return network_timer.getElapsedTime().asSeconds();
+}
+
+/*
+ * Record every datagram received and sent from now on into a capture
+ * file, see NetCapture.  The file is flushed at the end of each
+ * Transmit(), and closed by stopCapture() or Destroy().  Like
+ * setNetSim() it must be called before the network thread is started.
+ */
+bool Network::startCapture(const char *filename)
+{
+    if(threaded || replaying)
+    {
+        return false;
+    }
+    capture_start = getTime();
+    return capture.create(filename, getLocalPort());
+}
+
+void Network::stopCapture()
+{
+    if(!replaying)
+    {
+        capture.close();
+    }
+}
+
+/*
+ * Take received datagrams from a capture file instead of the socket,
+ * and send nothing.  The capture does not hold the secret or the
+ * tokens the clients were given, so the cookies, checks and challenge
+ * answers in it cannot be worked out again.  They are still worked
+ * out, so a replay costs what the real thing did, but while replaying
+ * a mismatch is let through: the traffic in the file is taken as it
+ * was.  Clients that connected after the capture started get the same
+ * connection ids as long as they connect in the same order.
+ *
+ * At the original speed the datagrams are received as long after the
+ * start of the replay as they were after the start of the capture.
+ * A fast replay leaves the network clock still, and advanceReplay()
+ * moves it on, so the caller can go through the capture as quickly as
+ * it is able to.
+ */
+bool Network::startReplay(const char *filename, bool fast)
+{
+    if(threaded || capture.isOpen() || !capture.open(filename))
+    {
+        return false;
+    }
+    replaying = true;
+    replay_fast = fast;
+    replay_time = 0.0;
+    network_timer.restart();
+    replay_have_next = capture.read(replay_next);
+    return true;
+}
+
+// True until every datagram in the capture has been received
+bool Network::replayPending()
+{
+    return replaying && replay_have_next;
+}
+
+void Network::advanceReplay(double seconds)
+{
+    replay_time += seconds;
+}
+
+void Network::receiveReplay()
+{
+    double current_time = getTime();
+    while(replay_have_next && (replay_next.time <= current_time))
+    {
+        // What was sent is left for the replay to work out again
+        if((NETCAPTURE_RECEIVED == replay_next.direction) && !replay_next.data.empty())
+        {
+            processDatagram(&replay_next.data[0], replay_next.data.size(),
+                            replay_next.addr, replay_next.port);
+        }
+        replay_have_next = capture.read(replay_next);
+    }
+}
+
+/*
+ * Move the socket work onto a thread of its own, so receiving,
+ * acknowledging and re-sending carry on at their own pace however long
+ * the game thread takes over a frame or a tick.  From then on Transmit()
+ * and Receive() do nothing, the send calls pass their messages to the
+ * network thread, and getData() takes the messages it has received.
+ * Each way goes through a bounded single producer, single consumer
+ * queue, so the two threads never wait on a lock.
+ *
+ * Nothing the network thread keeps is read by the game thread.  The
+ * changes in the state of the clients go through the same queue as the
+ * received messages, ahead of the messages that follow them, and the
+ * statistics through one of their own every NETWORK_STATS_INTERVAL.
+ * The game thread keeps its own picture of the clients from these,
+ * which getClientState() and getConnectionStats() read.
+ * setNetSim() must be called before the thread is started.
+ */
+void Network::startThread()
+{
+    if(threaded)
+    {
+        return;
+    }
+    commands = new SpscQueue<Network_Command_t>(NETWORK_QUEUE_SIZE);
+    if(delivered.isNull())
+    {
+        delivered = new SpscQueue<Received_Message_t>(NETWORK_QUEUE_SIZE);
+    }
+    if(published_stats.isNull())
+    {
+        published_stats = new SpscQueue<Published_Stats_t>(NETWORK_QUEUE_SIZE);
+    }
+    // Start the game thread's picture off from the clients as they are
+    game_clients.resize(clients.size());
+    for(unsigned int i = 0; i < clients.size(); i++)
+    {
+        clients[i]->published = clients[i]->disconnect;
+        clients[i]->published_generation = clients[i]->generation;
+        game_clients[i].generation = clients[i]->generation;
+        game_clients[i].disconnect = clients[i]->disconnect;
+        game_clients[i].have_stats = false;
+    }
+#ifdef NETWORK_USE_EVENTFD
+    if(wake_fd < 0)
+    {
+        wake_fd = eventfd(0, EFD_NONBLOCK);
+    }
+#endif
+    stats_published = getTime() - NETWORK_STATS_INTERVAL;
+    publishState();
+    io_running = 1;
+    threaded = true;
+    io_thread = new sf::Thread(&Network::runThread, this);
+    io_thread->launch();
+}
+
+// Go back to doing the socket work in Transmit() and Receive()
+void Network::stopThread()
+{
+    if(!threaded)
+    {
+        return;
+    }
+    __atomic_store_n(&io_running, 0, __ATOMIC_RELEASE);
+    io_thread->wait();
+    io_thread = NULL;
+    threaded = false;
+
+    // Carry out anything the thread did not get to
+    Network_Command_t *command;
+    while(NULL != (command = commands->front()))
+    {
+        runCommand(*command);
+        commands->release();
+    }
+    while(!game_backlog.empty())
+    {
+        runCommand(game_backlog.front());
+        game_backlog.pop_front();
+    }
+}
+
+void Network::runThread()
+{
+    sf::SocketSelector selector;
+    selector.add(net_socket);
+    Network_Command_t *command;
+    while(0 != __atomic_load_n(&io_running, __ATOMIC_ACQUIRE))
+    {
+        selector.wait(sf::milliseconds(NETWORK_THREAD_PERIOD));
+
+        // Run in place, so the entry keeps the memory of its packet
+        while(NULL != (command = commands->front()))
+        {
+            // Until the state is published again there is something pending
+            __atomic_store_n(&io_pending, 1u, __ATOMIC_RELEASE);
+            runCommand(*command);
+            commands->release();
+        }
+        receiveNow();
+        bool passed = deliverReceived();
+        transmitNow();
+        publishState();
+#ifdef NETWORK_USE_EVENTFD
+        // Only once the client count is up to date, so a game thread
+        // that wakes up sees the clients that have just connected
+        if(passed && (wake_fd >= 0))
+        {
+            uint64_t one = 1u;
+            ssize_t written = write(wake_fd, &one, sizeof(one));
+            (void)written;
+        }
+#endif
+    }
+}
+
+// Pass received messages to getData() for as long as there is room,
+// the rest wait in the client receive queues.  They only go once the
+// state changes ahead of them have.  True if anything was passed.
+bool Network::deliverReceived()
+{
+    bool passed = false;
+    if(!publishClients(passed))
+    {
+        return passed;
+    }
+    io_received.state_change = false;
+    while((!delivered->full()) && takeReceived(io_received.Data, &io_received.client))
+    {
+        delivered->push(io_received);
+        passed = true;
+    }
+    return passed;
+}
+
+// Pass on the clients whose state has changed since it was last passed
+// on, false if there was not room for all of them.
+bool Network::publishClients(bool& passed)
+{
+    for(unsigned int i = 0; i < clients.size(); i++)
+    {
+        Client_t *client = clients[i];
+        if((client->published == client->disconnect) && (client->published_generation == client->generation))
+        {
+            continue;
+        }
+        io_state.client = NETWORK_CLIENT_ID(client->handle, client->generation);
+        io_state.state = client->disconnect;
+        if(!delivered->push(io_state))
+        {
+            return false;
+        }
+        passed = true;
+        client->published = client->disconnect;
+        client->published_generation = client->generation;
+    }
+    return true;
+}
+
+void Network::publishState()
+{
+    __atomic_store_n(&io_numclients, (sf::Uint32)numclients, __ATOMIC_RELEASE);
+    __atomic_store_n(&io_pending, hasPending() ? 1u : 0u, __ATOMIC_RELEASE);
+    if(getTime() >= (stats_published + NETWORK_STATS_INTERVAL))
+    {
+        publishStats();
+    }
+}
+
+// Pass the totals and then the counters of each connected client over,
+// carrying on from where it got to last time if the queue filled up.
+void Network::publishStats()
+{
+    Published_Stats_t published;
+    memset(&published, 0, sizeof(published));
+    if(0u == stats_next)
+    {
+        if(published_stats->full())
+        {
+            return;
+        }
+        published.client = NETWORK_NO_CLIENT;
+        published.coalesce = makeCoalesceStats();
+        published.compression = compress_stats;
+        published.allocations = pool.getAllocations();
+        published_stats->push(published);
+    }
+    for(; stats_next < clients.size(); stats_next++)
+    {
+        Client_t *client = clients[stats_next];
+        if(client->disconnect == DISCONNECTED)
+        {
+            continue;
+        }
+        if(published_stats->full())
+        {
+            return;
+        }
+        published.client = NETWORK_CLIENT_ID(client->handle, client->generation);
+        fillConnectionStats(client, published.connection);
+        published_stats->push(published);
+    }
+    stats_next = 0u;
+    stats_published = getTime();
+}
+
+// Take the next message handed over by the network thread, keeping the
+// game thread's picture of the clients up to date on the way.
+bool Network::popDelivered()
+{
+    while((!delivered.isNull()) && delivered->pop(game_received))
+    {
+        if(!game_received.state_change)
+        {
+            return true;
+        }
+        sf::Uint16 handle = NETWORK_CLIENT_HANDLE(game_received.client);
+        if(handle >= game_clients.size())
+        {
+            game_clients.resize(handle + 1u);
+        }
+        Client_View_t& view = game_clients[handle];
+        if(view.generation != NETWORK_CLIENT_GENERATION(game_received.client))
+        {
+            view.generation = NETWORK_CLIENT_GENERATION(game_received.client);
+            view.have_stats = false;
+        }
+        view.disconnect = game_received.state;
+    }
+    return false;
+}
+
+// Catch up with the statistics the network thread has passed over
+void Network::takeStats()
+{
+    Published_Stats_t published;
+    while(published_stats->pop(published))
+    {
+        if(NETWORK_NO_CLIENT == published.client)
+        {
+            game_totals = published;
+            continue;
+        }
+        sf::Uint16 handle = NETWORK_CLIENT_HANDLE(published.client);
+        if((handle < game_clients.size()) &&
+           (game_clients[handle].generation == NETWORK_CLIENT_GENERATION(published.client)))
+        {
+            game_clients[handle].stats = published.connection;
+            game_clients[handle].have_stats = true;
+        }
     }
-    return tmp_client;
 }
 
 
@@ -5,19 +5,144 @@
 #include <SFML/Config.hpp>
 #include <SFML/Network.hpp>
 #include <SFML/System/Clock.hpp>
+#include <SFML/System/Thread.hpp>
 #include <vector>
 #include <queue>
+#include <deque>
+#include "SendWindow.h"
+#include "ReceiveWindow.h"
+#include "EndpointMap.h"
+#include "NetSim.h"
+#include "NetCapture.h"
+#include "NetCompress.h"
+#include "NetHeader.h"
+#include "SpscQueue.h"
+#include "MessagePool.h"
+#include "RingBuffer.h"
+#include "PacketView.h"
+#include "refptr.h"
 
-#define MAX_NUM_CLIENTS 8
+// On Linux, datagrams are sent and received in batches with
+// sendmmsg()/recvmmsg().  Define NETWORK_NO_MMSG to use the plain
+// SFML socket calls instead, or call setBatchedIo(false) to compare.
+#if defined(__linux__) && !defined(NETWORK_NO_MMSG)
+#define NETWORK_USE_MMSG
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+// On Linux the network thread signals an eventfd whenever it has passed
+// something to the game thread, so that can sleep in epoll on it.
+#if defined(__linux__) && !defined(NETWORK_NO_EVENTFD)
+#define NETWORK_USE_EVENTFD
+#endif
+
+// Upper limit on the number of connections per socket, the client
+// table itself grows as clients connect.
+#define MAX_NUM_CLIENTS 4096
 #define MAX_NUM_TUBES 4
 
-#define UNIQUE_ID   0xDEADBEEF
-#define RECEIVE_BUFFER_SIZE 1024
+#define RECEIVE_BUFFER_SIZE 1500
+
+// Largest datagram that Transmit() will pack messages into
+#define NETWORK_MTU 1200
+
+// Most bytes the header at the start of every datagram and the check
+// at its end take up, see NetHeader
+#define DATAGRAM_HEADER_SIZE NETHEADER_MAX_SIZE
+
+// Most bytes the framing of each message within a datagram takes up
+#define MESSAGE_HEADER_SIZE NETHEADER_MAX_MESSAGE_SIZE
+
+// Size of the IP and UDP headers the OS adds to every datagram
+#define UDP_IP_HEADER_SIZE 28
+
+// Largest message that goes in a datagram whole, anything bigger is
+// split into NETWORK_FRAGMENT messages.
+#define NETWORK_MAX_PAYLOAD (NETWORK_MTU - DATAGRAM_HEADER_SIZE - MESSAGE_HEADER_SIZE)
+
+// Size of the header at the start of each fragment's payload
+#define FRAGMENT_HEADER_SIZE 6
+#define FRAGMENT_PAYLOAD_SIZE (NETWORK_MAX_PAYLOAD - FRAGMENT_HEADER_SIZE)
+
+// Largest message that can be sent at all
+#define NETWORK_MAX_MESSAGE_SIZE (1024 * 1024)
+
+// Set in the message type of a message whose payload is compressed
+#define NETWORK_COMPRESSED_FLAG 0x80u
+
+// Smallest guaranteed message that is compressed, when that is enabled.
+// Run over captured games (replay --codec), nothing shorter came out
+// any smaller, while the player announcements just above it shrank to
+// about 40%.  Snapshots are left alone, being bit packed they only
+// shrink by about 2%.
+#define NETWORK_COMPRESS_THRESHOLD 32
+
+// Number of fragments sent for the first time to a client per
+// Transmit(), so a large message does not go out in one burst.
+#define NETWORK_FRAGMENT_BURST 8
+
+// In seconds, how long a partly received message is kept
+#define REASSEMBLY_TIMEOUT 10.0
+
+// Most large messages that can be partly received from one client at
+// once.  A fragment of another one is left unacknowledged, so it is
+// sent again later.
+#define MAX_NUM_REASSEMBLIES 16
+
+// Connection id in the header of handshake datagrams, sent before the
+// server has given out an id.
+#define NETWORK_NO_CONNECTION 0xFFFFu
+
+// In seconds, how often an unanswered handshake message is repeated
+#define NETWORK_CONNECT_RETRY 0.25
+
+// Number of entries in each of the queues between the game thread and
+// the network thread, must be a power of two
+#define NETWORK_QUEUE_SIZE 4096
+
+// In seconds, how often the network thread passes the statistics over
+// to the game thread
+#define NETWORK_STATS_INTERVAL 0.1
+
+// In milliseconds, longest the network thread waits for a datagram
+// before it sees to the commands and timers again
+#define NETWORK_THREAD_PERIOD 1
+
+// Number of datagrams moved per sendmmsg()/recvmmsg() call
+#define NETWORK_BATCH_SIZE 64
 
 // In seconds
+// Retransmit timeout used until a round trip time has been measured
 #define NETWORK_TIMEOUT 1
 
-#define MAX_NUM_SEND_ATTEMPTS 3
+// Bounds on the retransmit timeout calculated from the round trip time
+#define NETWORK_MIN_RTO 0.05
+#define NETWORK_MAX_RTO 2.0
+
+// In seconds, a NETWORK_PING goes out to a client that nothing else
+// has been sent to for this long, so the link does not look dead.
+#define NETWORK_KEEPALIVE_INTERVAL 1.0
+
+// In seconds, a client that nothing has been received from for this
+// long is considered gone.
+#define NETWORK_RECEIVE_TIMEOUT 5.0
+
+// In seconds, how long a client that has timed out is left for the
+// game to notice and disconnect, before its slot is freed regardless.
+#define NETWORK_TIMEOUT_REMOVE 5.0
+
+// In seconds, how often a timestamp goes in the header of the
+// datagrams to a client, for it to echo back
+#define NETWORK_TIMESTAMP_INTERVAL 0.05
+
+// Number of datagrams after the one with a new acknowledgement that
+// repeat it, in case that one was lost
+#define NETWORK_ACK_REPEATS 3
+
+// Number of times a guaranteed message is re-sent, with the timeout
+// doubling each time, before the client is considered gone.
+#define MAX_NUM_SEND_ATTEMPTS 8
 
 // The bit indicating if the message requires a response
 #define MSG_REQUIRES_RESPONSE_BIT ((sf::Uint16)1 << 15)
@@ -32,7 +157,13 @@ typedef enum{
     NETWORK_ACK,
     NETWORK_PING,
     NETWORK_NORMAL,
-    NETWORK_GUARANTEED
+    NETWORK_GUARANTEED,
+    NETWORK_SEQUENCED,
+    NETWORK_FRAGMENT,
+    NETWORK_CHALLENGE,
+    NETWORK_RESPONSE,
+    NETWORK_ACCEPT,
+    NETWORK_MIGRATE
 }Network_Messages_T;
 
 typedef enum{
@@ -40,67 +171,518 @@ typedef enum{
     CONNECTED,
     TIMEOUT_DISCONNECT,
     WAIT_DISCONNECT,
-    DO_DISCONNECT
+    DO_DISCONNECT,
+    // Waiting for the server to accept the connection
+    CONNECTING
 }Disconnect_States_t;
 
+/*
+ * The game refers to a client by its handle, in the low 16 bits, and
+ * the generation of its slot, in the high 16 bits.  The generation goes
+ * up each time the slot is freed, so an id kept from a client that has
+ * gone never refers to the one given its slot afterwards.
+ */
+typedef sf::Uint32 Client_Id_t;
+#define NETWORK_CLIENT_ID(handle, generation) (((Client_Id_t)(generation) << 16) | (sf::Uint16)(handle))
+#define NETWORK_CLIENT_HANDLE(id) ((sf::Uint16)((id) & 0xFFFFu))
+#define NETWORK_CLIENT_GENERATION(id) ((sf::Uint16)((id) >> 16))
+
+// No client in particular, a message is sent to every client
+#define NETWORK_NO_CLIENT 0xFFFFFFFFu
+
+// Number of buckets in the round trip time histogram.  Bucket n counts
+// the samples under (1 << n) milliseconds that did not fit in bucket
+// n - 1, and the last bucket also takes everything longer.
+#define NETWORK_RTT_BUCKETS 12
+
+// Weight of each new sample in the smoothed loss estimate
+#define NETWORK_LOSS_GAIN 0.05
+
+// Counters kept for each connection, see Network::getConnectionStats().
+// They count from when the connection was made.
 typedef struct{
+    sf::Uint32 datagrams_sent;
+    sf::Uint32 datagrams_received;
+    // Size of the datagrams, not counting the IP and UDP headers
+    sf::Uint64 bytes_sent;
+    sf::Uint64 bytes_received;
+    sf::Uint32 messages_sent;
+    sf::Uint32 messages_received;
+    // Guaranteed messages sent for the first time, and re-sends of them
+    sf::Uint32 guaranteed_sent;
+    sf::Uint32 resends;
+    // Seconds from first sending a guaranteed message to its ACK, only
+    // for messages that were acknowledged without being re-sent
+    double ack_latency_total;
+    double ack_latency_max;
+    sf::Uint32 ack_latency_count;
+    // Round trip time samples, see NETWORK_RTT_BUCKETS
+    sf::Uint32 rtt_histogram[NETWORK_RTT_BUCKETS];
+    // Smoothed fraction of guaranteed messages that had to be re-sent,
+    // an estimate of the packet loss on the link
+    double loss;
+    // The rest is filled in by getConnectionStats()
+    // Smoothed round trip time and its variance, in seconds
+    double rtt;
+    double rtt_var;
+    // Guaranteed messages not yet acknowledged, including those waiting
+    // for room in the send window
+    sf::Uint32 send_queue;
+    // Received messages waiting in getData()
+    sf::Uint32 receive_queue;
+} Connection_Stats_t;
+
+// Receive state of one channel of sequenced messages
+typedef struct{
+    // Newest sequence number received on the channel
+    sf::Uint16 latest;
+    // Position in the receive queue of the message from this channel
+    // that was queued last, counted from the first message ever queued.
+    sf::Uint32 queued_at;
+} Sequenced_Channel_t;
+
+// A received message, as the part of a pooled buffer it is in
+typedef struct{
+    sf::Uint32 message;
+    sf::Uint32 offset;
+    sf::Uint32 length;
+} Received_View_t;
+
+// A large message being put back together from its fragments
+typedef struct{
+    // Pooled fragments, MESSAGE_NONE for those yet to arrive
+    std::vector<sf::Uint32> fragments;
+    sf::Uint16 num_received;
+    // The message put back together is to be decompressed
+    bool compressed;
+    // Time the first fragment arrived
+    double started;
+} Reassembly_t;
+
+typedef struct{
+    // Index of this client in the client table, stays the same for
+    // as long as the client is connected.
+    sf::Uint16 handle;
+    // Goes up each time the slot is freed, see Client_Id_t
+    sf::Uint16 generation;
     sf::IpAddress addr;
     unsigned short port;
+    // Id given to the connection by the server, carried in the header of
+    // every datagram along with the token.  On the server it is the handle.
+    sf::Uint16 connection_id;
+    sf::Uint16 token;
+    // Random number picked by the connecting end for its handshake
+    sf::Uint32 nonce;
+    // Challenge from the server to be answered (connecting end only)
+    sf::Uint32 cookie;
+    bool have_cookie;
+    // Time the last handshake message was sent (connecting end only)
+    double handshake_sent;
+    // New address the client has been seen at, and the challenge sent
+    // there, which it has to answer before it is moved (server only)
+    sf::IpAddress migrate_addr;
+    unsigned short migrate_port;
+    sf::Uint32 migrate_challenge;
+    double migrate_sent;
+    // Time the last datagram was sent to and received from the client
+    double last_sent;
+    double last_received;
+    // Timestamp from the header of the last datagram received that
+    // had one, and when it arrived, to be echoed back in the next header.
+    sf::Uint16 peer_timestamp;
+    double peer_timestamp_received;
+    bool echo_pending;
+    // Time a timestamp was last sent to the client
+    double timestamp_sent;
+    // Number of datagrams still to repeat the last acknowledgement
+    sf::Uint8 ack_repeats;
+    // Smoothed round trip time
     double ping;
+    // Round trip time variance
+    double rtt_var;
+    // Current retransmit timeout, derived from ping and rtt_var
+    double rto;
+    bool rtt_measured;
     Disconnect_States_t disconnect;
+    // Time the client went to TIMEOUT_DISCONNECT
+    double timed_out;
     sf::Uint8 num_send_attempts;
-    std::queue<sf::Packet> receive;
+    // Messages waiting in getData() or getMessage()
+    RingBuffer<Received_View_t> receive;
+    // Number of messages taken out of the receive queue so far
+    sf::Uint32 receive_head;
+    // Sequenced channels that something has been received on
+    std::map<sf::Uint8, Sequenced_Channel_t> sequenced;
+    // Next sequence number to send to this client on each channel
+    std::map<sf::Uint8, sf::Uint16> sequenced_next;
+    // Guaranteed messages waiting to be acknowledged by this client
+    refptr<SendWindow> window;
+    // Guaranteed messages received from this client
+    refptr<ReceiveWindow> received;
+    // Received messages too old to be covered by the ACK bitfield,
+    // these are acknowledged explicitly in a NETWORK_ACK message.
+    std::vector<sf::Uint16> late_acks;
+    // Large messages partly received from this client, by message id
+    std::map<sf::Uint16, Reassembly_t> reassembly;
+    // Bit mask of the groups the client belongs to, see sendToGroup()
+    sf::Uint32 groups;
+    Connection_Stats_t stats;
+    // State and generation last passed to the game thread
+    Disconnect_States_t published;
+    sf::Uint16 published_generation;
 }Client_t;
 
+/*
+ * A connection is set up with a handshake, where the client repeats
+ * each step until it gets the answer:
+ *   client NETWORK_CONNECT   Uint32 nonce
+ *   server NETWORK_CHALLENGE Uint32 nonce, Uint32 cookie
+ *   client NETWORK_RESPONSE  Uint32 nonce, Uint32 cookie
+ *   server NETWORK_ACCEPT    Uint32 nonce, Uint16 connection id, Uint16 token
+ * The cookie is a hash of the client's address and nonce with a server
+ * secret, so the server keeps nothing for a client until it has shown
+ * that it can receive at its address.  A connection from an address
+ * that already has one only replaces it, and times the old one out,
+ * once it has answered the challenge.  Handshake datagrams carry one
+ * message each and NETWORK_NO_CONNECTION as their connection id.
+ *
+ * Datagrams are laid out as described in NetHeader.  The header holds:
+ *   connection id, the index of the client on the server
+ *   ack, the latest guaranteed sequence received from the peer, and
+ *        ack bits, bit n set if sequence (ack - n) was received
+ *   timestamp, the sender's clock in milliseconds
+ *   echo, the last timestamp received from the peer plus the
+ *        milliseconds since it arrived
+ * The ack goes in every datagram from the one after a guaranteed
+ * message arrives until NETWORK_ACK_REPEATS more have gone out, so
+ * acknowledgements ride along with whatever is sent next.  A
+ * standalone NETWORK_ACK is only sent if nothing else was going out.
+ * A timestamp goes out every NETWORK_TIMESTAMP_INTERVAL, and is echoed
+ * once.  The round trip time is the sender's clock now less the echo,
+ * so it is measured without sending anything extra.  An empty
+ * NETWORK_PING is only sent on a link that has been idle for
+ * NETWORK_KEEPALIVE_INTERVAL.
+ * The token given out with the connection id is not sent, but goes
+ * into the check at the end of each datagram.  The server finds the
+ * client by indexing its table with the connection id.
+ *
+ * A client that turns up at a new address or port, most likely after a
+ * NAT rebinding, is followed there once it has shown it is the client:
+ *   server NETWORK_MIGRATE   Uint32 challenge, sent to the new address
+ *   client NETWORK_MIGRATE   Uint32 challenge, Uint32 proof
+ * The proof is a hash of the challenge with the nonce of the client's
+ * handshake, which nobody else has seen.  Until the answer arrives
+ * nothing else from the new address is used, so a datagram whose 16 bit
+ * check was guessed, or an old one sent again, cannot move the client.
+ * A wrong answer uses the challenge up, and a new one only goes out
+ * every NETWORK_CONNECT_RETRY.
+ *
+ * The header is followed by as many messages as fit in NETWORK_MTU,
+ * each with its type, a sequence number for guaranteed, sequenced and
+ * fragment messages, and its length.  The payload of a sequenced
+ * message starts with its Uint8 channel.
+ * The message type has NETWORK_COMPRESSED_FLAG set if the payload is
+ * compressed, see NetCompress.  For fragments it is the whole message
+ * that was compressed before it was split up.
+ *
+ * A guaranteed message too big for one datagram is sent as a number of
+ * guaranteed NETWORK_FRAGMENT messages, so only the pieces that are
+ * lost get re-sent.  Each fragment's payload starts with:
+ *   Uint16 id of the message it belongs to
+ *   Uint16 index of the fragment
+ *   Uint16 number of fragments in the message
+ */
+
+// Counters showing how well messages are being packed into datagrams
 typedef struct{
-    // The packet
-    sf::Packet Data;
+    sf::Uint32 messages_sent;
+    sf::Uint32 datagrams_sent;
+    // Bytes saved compared to sending every message in its own datagram
+    sf::Int32 bytes_saved;
+} Coalesce_Stats_t;
+
+// Counters showing how much compression is saving, and what it costs
+typedef struct{
+    sf::Uint32 messages_compressed;
+    // Messages that did not come out any smaller, and were sent as they were
+    sf::Uint32 messages_skipped;
+    sf::Uint64 bytes_in;
+    sf::Uint64 bytes_out;
+    // Time spent compressing, in seconds
+    double seconds;
+} Compression_Stats_t;
+
+// A message that is sent once and then forgotten.  Guaranteed
+// messages are kept in each client's SendWindow instead.
+typedef struct{
+    // The payload in the message pool
+    sf::Uint32 message;
 
     // The type of message that is to be sent.
     Network_Messages_T msg_type;
 
-    // Destination client for an ACK message
-    // Perhaps later I will enable the ability to only send updates
-    // to specific clients.
+    // Destination client, or NULL to send to every client
     Client_t * dest;
 
-    // The time at which the message was origionally sent
-    double TimeStarted;
+    // Only clients in one of these groups get the message, 0 for all
+    sf::Uint32 groups;
+} Transmit_Message_t;
 
-    // The time at which the message was last sent to each client
-    std::map<Client_t*, double> ClientTimeSent;
+// Work passed from the game thread to the network thread
+typedef enum{
+    NETWORK_COMMAND_SEND,
+    NETWORK_COMMAND_SEQUENCED,
+    NETWORK_COMMAND_DISCONNECT,
+    NETWORK_COMMAND_GROUPS
+}Network_Commands_T;
 
-    // The time at which a response was received from each client
-    std::map<Client_t*, double> Responses;
-} Transmit_Message_t;
+typedef struct{
+    Network_Commands_T command;
+    Network_Messages_T msg_type;
+    sf::Packet Data;
+    // Looked up by the network thread, a client that has gone by then
+    // is not sent anything
+    Client_Id_t dest;
+    // Groups a message is sent to, or the groups dest is put in
+    sf::Uint32 groups;
+    sf::Uint8 channel;
+} Network_Command_t;
+
+// A message passed from the network thread to getData(), or a change
+// in the state of a client, passed along in order with the messages
+typedef struct{
+    sf::Packet Data;
+    Client_Id_t client;
+    bool state_change;
+    Disconnect_States_t state;
+} Received_Message_t;
+
+// The game thread's picture of a client while the network thread runs
+typedef struct{
+    sf::Uint16 generation;
+    Disconnect_States_t disconnect;
+    bool have_stats;
+    Connection_Stats_t stats;
+} Client_View_t;
+
+// Statistics passed from the network thread every NETWORK_STATS_INTERVAL,
+// those of one client, or with NETWORK_NO_CLIENT the totals
+typedef struct{
+    Client_Id_t client;
+    Connection_Stats_t connection;
+    Coalesce_Stats_t coalesce;
+    Compression_Stats_t compression;
+    sf::Uint32 allocations;
+} Published_Stats_t;
+
+// sf::UdpSocket hides its OS handle, which the batched calls need
+class NetworkSocket : public sf::UdpSocket
+{
+    public:
+        sf::SocketHandle getSocketHandle() const { return getHandle(); }
+};
 
 class Network{
     private:
         sf::Uint16 numclients;
-        sf::UdpSocket  net_socket;
-        std::map<sf::Uint32, Transmit_Message_t*> transmit_queue;
-        char rxbuff[RECEIVE_BUFFER_SIZE];
+        NetworkSocket  net_socket;
+        std::vector<Transmit_Message_t> transmit_queue;
+        // Pooled buffers the next datagrams are received into
+        sf::Uint32 rx_messages[NETWORK_BATCH_SIZE];
+        // Buffer of the datagram being handled, MESSAGE_NONE if it
+        // was copied out of the buffer it was received into
+        sf::Uint32 rx_message;
         sf::Clock message_timer;
         sf::Clock network_timer;
-        sf::Uint32 getUniqueMessageId();
-        int addClients(Client_t *client, sf::Uint16 *curcl);
-        int findClient(Client_t *client);
-        bool queueTransmitMessage(Network_Messages_T msg_type , sf::Packet p, Client_t * dest = NULL);
-        Client_t clients[MAX_NUM_CLIENTS];
+        Client_t* addClient(const sf::IpAddress& addr, unsigned short port);
+        Client_t* findClient(const sf::IpAddress& addr, unsigned short port);
+        void timeOutClient(Client_t *client);
+        void removeClient(Client_t *client);
+        void queueReceived(Client_t *client, const Received_View_t& received);
+        Received_View_t keepReceived(const char *data, std::size_t size);
+        Received_View_t wholeMessage(sf::Uint32 message);
+        bool takeView(Received_View_t& received, Client_Id_t* sending_client);
+        Client_t* findClientId(Client_Id_t id);
+        void fillConnectionStats(Client_t *client, Connection_Stats_t& stats);
+        Coalesce_Stats_t makeCoalesceStats();
+        sf::Uint32 copyToPool(const char *data, std::size_t size);
+        bool queueTransmitMessage(Network_Messages_T msg_type, const char *data, std::size_t size, Client_t * dest, sf::Uint32 groups);
+        void queueMessage(Network_Messages_T msg_type, sf::Uint8 flags, sf::Uint32 message, Client_t * dest, sf::Uint32 groups);
+        bool queueSequencedMessage(const char *data, std::size_t size, sf::Uint8 channel, Client_t* dest);
+        bool isRecipient(Client_t *client, Client_t *dest, sf::Uint32 groups);
+        void appendMessage(Client_t *client, sf::Packet& datagram, sf::Uint8 msg_type, sf::Uint16 msg_id, const char *data, sf::Uint16 length);
+        void flushDatagram(Client_t *client, sf::Packet& datagram);
+        void processMessage(Client_t *client, sf::Uint8 msg_type, sf::Uint16 msg_id, const char *data, sf::Uint16 length);
+        void processDatagram(const char *data, std::size_t size, const sf::IpAddress& addr, unsigned short port);
+        Client_t* findConnection(sf::Uint16 connection_id, DatagramReader& reader);
+        void checkMigration(Client_t *client, DatagramReader& reader, const sf::IpAddress& addr, unsigned short port);
+        void sendMigrate(Client_t *client);
+        static sf::Uint32 makeMigrateProof(sf::Uint32 nonce, sf::Uint32 challenge);
+        void processHandshake(sf::Uint8 msg_type, const char *data, sf::Uint16 length, const sf::IpAddress& addr, unsigned short port);
+        void sendHandshake(sf::Uint8 msg_type, sf::Packet& p, const sf::IpAddress& addr, unsigned short port);
+        void sendAccept(Client_t *client);
+        sf::Uint32 makeCookie(const sf::IpAddress& addr, unsigned short port, sf::Uint32 nonce);
+        sf::Uint32 random();
+        // True for the end that accepts connections
+        bool is_server;
+        sf::Uint32 secret;
+        sf::Uint32 rng_state;
+        void receiveDatagram(sf::Uint32& buffer, std::size_t size, const sf::IpAddress& addr, unsigned short port);
+        void sendDatagram(const char *data, std::size_t size, const sf::IpAddress& addr, unsigned short port);
+        void sendToSocket(const char *data, std::size_t size, const sf::IpAddress& addr, unsigned short port);
+        void flushSendBatch();
+        // Simulated network conditions on the way out and the way in
+        NetSim sim_out;
+        NetSim sim_in;
+        std::vector<char> sim_buff;
+        // Datagrams being recorded to, or replayed from, a file
+        NetCapture capture;
+        double capture_start;
+        bool replaying;
+        bool replay_fast;
+        double replay_time;
+        NetCapture_Record_t replay_next;
+        bool replay_have_next;
+        void receiveReplay();
+        double getTime();
+#ifdef NETWORK_USE_MMSG
+        void initBatches();
+        // Cleared if the kernel turns out not to support the batched calls
+        bool batched_io;
+        struct mmsghdr tx_msgs[NETWORK_BATCH_SIZE];
+        struct iovec tx_iov[NETWORK_BATCH_SIZE];
+        struct sockaddr_in tx_addr[NETWORK_BATCH_SIZE];
+        char tx_buff[NETWORK_BATCH_SIZE][NETWORK_MTU];
+        unsigned int tx_count;
+        struct mmsghdr rx_msgs[NETWORK_BATCH_SIZE];
+        struct iovec rx_iov[NETWORK_BATCH_SIZE];
+        struct sockaddr_in rx_addr[NETWORK_BATCH_SIZE];
+#endif
+        void processAcks(Client_t *client, sf::Uint16 ack, sf::Uint32 ack_bits);
+        void acknowledgeMessage(Client_t *client, sf::Uint16 sequence);
+        void updateRtt(Client_t *client, double sample);
+        static sf::Uint16 getTimestamp(double time);
+        void writeHeader(Client_t *client, sf::Packet& datagram);
+        // Client slots are never freed until Reset(), so handles and
+        // Client_t pointers stay valid while a client is connected.
+        std::vector<Client_t*> clients;
+        std::vector<sf::Uint16> free_handles;
+        EndpointMap client_lookup;
+        // Handles of clients with received messages waiting in getData()
+        RingBuffer<sf::Uint16> ready_clients;
+        sf::Uint32 messages_sent;
+        sf::Uint32 datagrams_sent;
+        // Header and check bytes of all the datagrams sent, and the
+        // framing bytes the messages saved by sharing datagrams
+        sf::Uint64 header_bytes_sent;
+        sf::Uint64 framing_bytes_saved;
+        void queueSequenced(Client_t *client, sf::Uint16 sequence, const char *data, sf::Uint16 length);
+        // Id of the next message to be split into fragments
+        sf::Uint16 next_fragmented;
+        void queueFragments(const char *data, std::size_t size, sf::Uint8 flags, Client_t *dest, sf::Uint32 groups);
+        void reassemble(Client_t *client, const char *data, sf::Uint16 length, bool compressed);
+        bool canReassemble(Client_t *client, sf::Uint16 msg_id, const char *data, sf::Uint16 length);
+        sf::Uint32 decompressToPool(const char *data, std::size_t size);
+        bool compression;
+        NetCompress codec;
+        std::vector<char> compress_buff;
+        sf::Clock compress_timer;
+        Compression_Stats_t compress_stats;
+        void releaseReassembly(Reassembly_t& reassembly);
+        // Every message payload the network holds lives in the pool
+        MessagePool pool;
+        sf::Packet tx_datagram;
+        DatagramWriter tx_writer;
+        // Hash of the protocol name and version every check starts from
+        sf::Uint32 protocol_id;
+        void expireReassembly(Client_t *client, double current_time);
+
+        // Everything from here on is done by the network thread once
+        // it has been started, the game thread only passes it commands.
+        bool send(Network_Messages_T msg_type, sf::Packet& p, Client_Id_t dest, sf::Uint32 groups);
+        bool submit(Network_Command_t& command);
+        void submitBacklog();
+        Network_Command_t* reserveCommand();
+        bool runCommand(Network_Command_t& command);
+        bool takeReceived(sf::Packet& p, Client_Id_t* sending_client);
+        void transmitNow();
+        void receiveNow();
+        bool hasPending();
+        void runThread();
+        bool deliverReceived();
+        bool publishClients(bool& passed);
+        void publishState();
+        void publishStats();
+        bool popDelivered();
+        void takeStats();
+        bool threaded;
+        refptr<sf::Thread> io_thread;
+        refptr<SpscQueue<Network_Command_t> > commands;
+        refptr<SpscQueue<Received_Message_t> > delivered;
+        refptr<SpscQueue<Published_Stats_t> > published_stats;
+        // Commands that did not fit in the queue, and the messages
+        // dropped for want of room
+        std::deque<Network_Command_t> game_backlog;
+        sf::Uint32 game_dropped;
+        // Kept between calls so their packets keep their memory
+        Received_Message_t game_received;
+        Received_Message_t io_received;
+        Received_Message_t io_state;
+        // Time the statistics were last passed over, and the client
+        // to carry on from if there was no room for all of them
+        double stats_published;
+        sf::Uint16 stats_next;
+        // Only touched by the game thread while the network thread runs
+        std::vector<Client_View_t> game_clients;
+        Published_Stats_t game_totals;
+        // Written by the network thread and read by the game thread
+        int io_running;
+        sf::Uint32 io_pending;
+        sf::Uint32 io_numclients;
+        int wake_fd;
 
     public:
+        Network();
+        ~Network();
         void Create( sf::Uint16 port, sf::IpAddress address );
         void Destroy();
-        bool getData(sf::Packet& p, sf::Uint8* sending_client = NULL);
+        bool getData(sf::Packet& p, Client_Id_t* sending_client = NULL);
+        bool getMessage(PacketView& view, Client_Id_t* sending_client = NULL);
+        void releaseMessage(PacketView& view);
         bool sendData(sf::Packet& p, bool guaranteed = false);
+        bool sendTo(sf::Packet& p, Client_Id_t dest, bool guaranteed = false);
+        bool sendToGroup(sf::Packet& p, sf::Uint32 group_mask, bool guaranteed = false);
+        bool sendSequenced(sf::Packet& p, sf::Uint8 channel, Client_Id_t dest = NETWORK_NO_CLIENT);
         int  getNumConnected();
         void Transmit();
         void Receive();
         void Reset();
         bool pendingMessages();
         sf::Uint16 getLocalPort();
-        void disconnectClient(Client_t* player_client);
-        Client_t* getClient( sf::Uint8 client_ndx );
+        sf::SocketHandle getSocketHandle();
+        int getWakeHandle();
+        void disconnectClient(Client_Id_t player_client);
+        Client_t* getClient( Client_Id_t client );
+        Disconnect_States_t getClientState(Client_Id_t client);
+        void setClientGroups(Client_Id_t client, sf::Uint32 groups);
+        Coalesce_Stats_t getCoalesceStats();
+        void setCompression(bool enabled) { compression = enabled; }
+        void setBatchedIo(bool enabled);
+        bool isBatchedIo();
+        Compression_Stats_t getCompressionStats();
+        bool getConnectionStats(Client_Id_t client, Connection_Stats_t& stats);
+        static double getRttPercentile(const Connection_Stats_t& stats, double fraction);
+        sf::Uint32 getAllocationCount();
+        sf::Uint32 getDroppedCount();
+        void setNetSim(const NetSim_Config_t& config);
+        bool startCapture(const char *filename);
+        void stopCapture();
+        bool startReplay(const char *filename, bool fast);
+        bool replayPending();
+        void advanceReplay(double seconds);
+        void startThread();
+        void stopThread();
+        bool isThreaded() { return threaded; }
 };
 
 sf::Packet& operator <<(sf::Packet& Packet, const Network_Messages_T& NMT);
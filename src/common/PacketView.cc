@@ -0,0 +1,117 @@
+#include "PacketView.h"
+#include <cstring>
+
+PacketView::PacketView()
+{
+    set(NULL, 0u, PACKET_VIEW_NONE);
+}
+
+void PacketView::set(const char *data, std::size_t size, sf::Uint32 message)
+{
+    m_data = data;
+    m_size = size;
+    m_read_pos = 0u;
+    m_valid = true;
+    m_message = message;
+}
+
+bool PacketView::checkSize(std::size_t size)
+{
+    m_valid = m_valid && ((m_read_pos + size) <= m_size);
+    return m_valid;
+}
+
+// Integers are sent in network byte order, as sf::Packet does
+sf::Uint32 PacketView::readBigEndian(std::size_t size)
+{
+    sf::Uint32 value = 0u;
+    if(checkSize(size))
+    {
+        const sf::Uint8 *bytes = (const sf::Uint8 *)&m_data[m_read_pos];
+        for(std::size_t i = 0u; i < size; i++)
+        {
+            value = (value << 8) | bytes[i];
+        }
+        m_read_pos += size;
+    }
+    return value;
+}
+
+PacketView& PacketView::operator >>(bool& data)
+{
+    data = (0u != readBigEndian(1u));
+    return *this;
+}
+
+PacketView& PacketView::operator >>(sf::Int8& data)
+{
+    data = (sf::Int8)readBigEndian(1u);
+    return *this;
+}
+
+PacketView& PacketView::operator >>(sf::Uint8& data)
+{
+    data = (sf::Uint8)readBigEndian(1u);
+    return *this;
+}
+
+PacketView& PacketView::operator >>(sf::Int16& data)
+{
+    data = (sf::Int16)readBigEndian(2u);
+    return *this;
+}
+
+PacketView& PacketView::operator >>(sf::Uint16& data)
+{
+    data = (sf::Uint16)readBigEndian(2u);
+    return *this;
+}
+
+PacketView& PacketView::operator >>(sf::Int32& data)
+{
+    data = (sf::Int32)readBigEndian(4u);
+    return *this;
+}
+
+PacketView& PacketView::operator >>(sf::Uint32& data)
+{
+    data = readBigEndian(4u);
+    return *this;
+}
+
+// Floating point values go in the packet as they are in memory
+PacketView& PacketView::operator >>(float& data)
+{
+    data = 0.0f;
+    if(checkSize(sizeof(data)))
+    {
+        memcpy(&data, &m_data[m_read_pos], sizeof(data));
+        m_read_pos += sizeof(data);
+    }
+    return *this;
+}
+
+PacketView& PacketView::operator >>(double& data)
+{
+    data = 0.0;
+    if(checkSize(sizeof(data)))
+    {
+        memcpy(&data, &m_data[m_read_pos], sizeof(data));
+        m_read_pos += sizeof(data);
+    }
+    return *this;
+}
+
+// A Uint32 length followed by the characters
+PacketView& PacketView::operator >>(std::string& data)
+{
+    sf::Uint32 length = 0u;
+    *this >> length;
+    data.clear();
+    if((length > 0u) && checkSize(length))
+    {
+        data.assign(&m_data[m_read_pos], length);
+        m_read_pos += length;
+    }
+    return *this;
+}
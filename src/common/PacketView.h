@@ -0,0 +1,51 @@
+#ifndef PACKETVIEW_H
+#define PACKETVIEW_H
+
+#include <string>
+#include <cstddef>
+#include <SFML/Config.hpp>
+
+// Handle of a view that holds no pooled message, see MESSAGE_NONE
+#define PACKET_VIEW_NONE 0xFFFFFFFFu
+
+/*
+ * Read only view of a received message, read the same way as the
+ * sf::Packet it was sent as, without copying it out of the buffer it
+ * arrived in.  The data belongs to the Network that handed out the
+ * view, and stays valid until the view is given back with
+ * Network::releaseMessage() or used for the next Network::getMessage().
+ * Reading past the end reads zeros and makes the view invalid.
+ */
+class PacketView
+{
+    public:
+        PacketView();
+        const char *getData() const { return m_data; }
+        std::size_t getDataSize() const { return m_size; }
+        bool endOfPacket() const { return m_read_pos >= m_size; }
+        bool isValid() const { return m_valid; }
+        PacketView& operator >>(bool& data);
+        PacketView& operator >>(sf::Int8& data);
+        PacketView& operator >>(sf::Uint8& data);
+        PacketView& operator >>(sf::Int16& data);
+        PacketView& operator >>(sf::Uint16& data);
+        PacketView& operator >>(sf::Int32& data);
+        PacketView& operator >>(sf::Uint32& data);
+        PacketView& operator >>(float& data);
+        PacketView& operator >>(double& data);
+        PacketView& operator >>(std::string& data);
+    protected:
+        friend class Network;
+        void set(const char *data, std::size_t size, sf::Uint32 message);
+        bool checkSize(std::size_t size);
+        sf::Uint32 readBigEndian(std::size_t size);
+
+        const char *m_data;
+        std::size_t m_size;
+        std::size_t m_read_pos;
+        bool m_valid;
+        // The pooled buffer the data is in, or PACKET_VIEW_NONE
+        sf::Uint32 m_message;
+};
+
+#endif
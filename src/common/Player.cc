@@ -14,8 +14,15 @@ Player::Player()
     d_pressed = KEY_NOT_PRESSED;
     rel_mouse_movement = 0.0;
     updated = false;
-    m_client = NULL;
+    m_client = NETWORK_NO_CLIENT;
     m_shot = NULL;
     m_shot_allowed = true;
     m_is_dead = false;
+    m_snapshot_ack = 0u;
+    m_snapshot_acked = false;
+    m_snapshot_sent = 0.0;
+    m_budget = 0.0;
+    m_budget_stats.given = 0.0;
+    m_budget_stats.used = 0.0;
+    m_budget_stats.deferred = 0u;
 }
@@ -2,12 +2,23 @@
 #define PLAYER_H
 
 #include <string>
+#include <map>
 #include "Types.h"
 #include "SFML/Config.hpp"
 #include "Network.h"
 #include "Shot.h"
+#include "Snapshot.h"
 #include "refptr.h"
 
+// How much of a client's bandwidth budget was used (server only)
+typedef struct{
+    // Bytes the client was allowed and the bytes actually sent
+    double given;
+    double used;
+    // Number of times a player's update was held back to stay in budget
+    sf::Uint32 deferred;
+} Budget_Stats_t;
+
 class Player
 {
     public:
@@ -22,10 +33,25 @@ class Player
         sf::Uint8 d_pressed;
         sf::Int32 rel_mouse_movement;
         bool updated;
-        Client_t* m_client;
+        Client_Id_t m_client;
         bool m_shot_allowed;
         refptr<Shot> m_shot;
         bool m_is_dead;
+        // World snapshots sent to the client, each one only holds what
+        // this player is interested in (server only)
+        refptr<SnapshotHistory> m_snapshots;
+        Snapshot m_last_snapshot;
+        // Latest world snapshot the client has acknowledged (server only)
+        sf::Uint16 m_snapshot_ack;
+        bool m_snapshot_acked;
+        // Time the last snapshot was sent to the client (server only)
+        double m_snapshot_sent;
+        // Accumulated priority of sending each player's state to the
+        // client, by player index (server only)
+        std::map<sf::Uint8, double> m_priority;
+        // Bytes the client can be sent before going over budget (server only)
+        double m_budget;
+        Budget_Stats_t m_budget_stats;
 
         Player();
 };
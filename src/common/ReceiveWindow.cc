@@ -0,0 +1,99 @@
+#include "ReceiveWindow.h"
+
+ReceiveWindow::ReceiveWindow()
+{
+    clear();
+}
+
+// Record a received sequence number.  Returns false if the message
+// has already been received (or is too old to tell).  Any sequence
+// numbers that fall out of the ACK bitfield before their acknowledgement
+// was sent, or that are already too old for it, are added to late_acks.
+bool ReceiveWindow::receive(sf::Uint16 sequence, std::vector<sf::Uint16>& late_acks)
+{
+    bool new_message = false;
+    sf::Uint16 ndx = sequence & (SEND_WINDOW_SIZE - 1);
+
+    if((0u == m_ack_bits) || sequenceGreaterThan(sequence, m_latest))
+    {
+        sf::Uint16 shift = sequence - m_latest;
+        if(0u == m_ack_bits)
+        {
+            shift = ACK_BITS_SIZE;
+        }
+
+        // Collect the unsent acknowledgements being shifted out
+        for(sf::Uint16 n = ACK_BITS_SIZE - ((shift < ACK_BITS_SIZE) ? shift : ACK_BITS_SIZE);
+            n < ACK_BITS_SIZE; n++)
+        {
+            if(m_unsent_bits & ((sf::Uint32)1u << n))
+            {
+                late_acks.push_back(m_latest - n);
+            }
+        }
+
+        if(shift >= ACK_BITS_SIZE)
+        {
+            m_ack_bits = 1u;
+            m_unsent_bits = 1u;
+        }
+        else
+        {
+            m_ack_bits = (m_ack_bits << shift) | 1u;
+            m_unsent_bits = (m_unsent_bits << shift) | 1u;
+        }
+        m_latest = sequence;
+        new_message = true;
+    }
+    else
+    {
+        sf::Uint16 age = m_latest - sequence;
+        // The sender can never have more than a window's worth of
+        // messages in flight, so anything older must be a duplicate.
+        if(age < SEND_WINDOW_SIZE)
+        {
+            new_message = !(m_valid[ndx] && (m_entries[ndx] == sequence));
+
+            // Always respond, even to a duplicate, since the previous
+            // acknowledgement may have been lost.
+            if(age < ACK_BITS_SIZE)
+            {
+                m_ack_bits |= ((sf::Uint32)1u << age);
+                m_unsent_bits |= ((sf::Uint32)1u << age);
+            }
+            else
+            {
+                late_acks.push_back(sequence);
+            }
+        }
+    }
+
+    if(new_message)
+    {
+        m_entries[ndx] = sequence;
+        m_valid[ndx] = true;
+    }
+    return new_message;
+}
+
+bool ReceiveWindow::isDuplicate(sf::Uint16 sequence)
+{
+    if((0u == m_ack_bits) || sequenceGreaterThan(sequence, m_latest))
+    {
+        return false;
+    }
+    sf::Uint16 ndx = sequence & (SEND_WINDOW_SIZE - 1);
+    return ((sf::Uint16)(m_latest - sequence) >= SEND_WINDOW_SIZE) ||
+           (m_valid[ndx] && (m_entries[ndx] == sequence));
+}
+
+void ReceiveWindow::clear()
+{
+    for(int i = 0; i < SEND_WINDOW_SIZE; i++)
+    {
+        m_valid[i] = false;
+    }
+    m_latest = 0u;
+    m_ack_bits = 0u;
+    m_unsent_bits = 0u;
+}
@@ -0,0 +1,40 @@
+#ifndef RECEIVEWINDOW_H
+#define RECEIVEWINDOW_H
+
+#include <vector>
+#include <SFML/Config.hpp>
+#include "SendWindow.h"
+
+// Number of sequence numbers covered by the ACK bitfield
+#define ACK_BITS_SIZE 32
+
+/*
+ * History of the guaranteed message sequence numbers received from a
+ * client.  Used to drop duplicate messages caused by re-sends, and to
+ * build the "latest sequence + bitfield" acknowledgement carried in the
+ * header of every datagram sent back to that client.
+ */
+class ReceiveWindow
+{
+    public:
+        ReceiveWindow();
+        bool receive(sf::Uint16 sequence, std::vector<sf::Uint16>& late_acks);
+        // True if receive() would take the message for a duplicate
+        bool isDuplicate(sf::Uint16 sequence);
+        void clear();
+        sf::Uint16 getAck() { return m_latest; }
+        // Bit n is set if sequence (getAck() - n) has been received
+        sf::Uint32 getAckBits() { return m_ack_bits; }
+        // True if something was received since the ACK was last sent
+        bool ackPending() { return (0u != m_unsent_bits); }
+        void ackSent() { m_unsent_bits = 0u; }
+    protected:
+        sf::Uint16 m_entries[SEND_WINDOW_SIZE];
+        bool m_valid[SEND_WINDOW_SIZE];
+        sf::Uint16 m_latest;
+        sf::Uint32 m_ack_bits;
+        // Bits of m_ack_bits that have not been sent to the peer yet
+        sf::Uint32 m_unsent_bits;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <vector>
+
+// Number of entries a ring buffer starts with, must be a power of two
+#define RING_BUFFER_INITIAL_SIZE 16
+
+/*
+ * First in, first out queue that can also be indexed from the front.
+ * Unlike std::deque it keeps its storage when emptied, doubling it when
+ * it fills up, so a queue that is used over and over stops allocating.
+ */
+template <typename T>
+class RingBuffer
+{
+    public:
+        RingBuffer() : m_head(0u), m_count(0u) {}
+        bool empty() const { return (0u == m_count); }
+        unsigned int size() const { return m_count; }
+        T & front() { return m_entries[m_head]; }
+        T & operator[](unsigned int ndx)
+        {
+            return m_entries[(m_head + ndx) & (m_entries.size() - 1u)];
+        }
+        void push_back(const T & item)
+        {
+            if(m_count == m_entries.size())
+            {
+                grow();
+            }
+            m_entries[(m_head + m_count) & (m_entries.size() - 1u)] = item;
+            m_count++;
+        }
+        void pop_front()
+        {
+            m_head = (m_head + 1u) & (m_entries.size() - 1u);
+            m_count--;
+        }
+        void clear()
+        {
+            m_head = 0u;
+            m_count = 0u;
+        }
+
+    protected:
+        void grow()
+        {
+            std::vector<T> entries(m_entries.empty() ? RING_BUFFER_INITIAL_SIZE : (m_entries.size() * 2u));
+            for(unsigned int i = 0; i < m_count; i++)
+            {
+                entries[i] = (*this)[i];
+            }
+            m_entries.swap(entries);
+            m_head = 0u;
+        }
+
+        std::vector<T> m_entries;
+        unsigned int m_head;
+        unsigned int m_count;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "SendWindow.h"
+
+SendWindow::SendWindow(MessagePool* pool)
+{
+    m_pool = pool;
+    for(int i = 0; i < SEND_WINDOW_SIZE; i++)
+    {
+        m_entries[i].in_use = false;
+    }
+    clear();
+}
+
+void SendWindow::push(sf::Uint8 msg_type, sf::Uint32 message)
+{
+    Backlog_Entry_t entry;
+    entry.msg_type = msg_type;
+    entry.message = message;
+    m_backlog.push_back(entry);
+    fill();
+}
+
+Send_Window_Entry_t* SendWindow::find(sf::Uint16 sequence)
+{
+    Send_Window_Entry_t* entry = &m_entries[sequence & (SEND_WINDOW_SIZE - 1)];
+    if((!entry->in_use) || (entry->sequence != sequence))
+    {
+        entry = NULL;
+    }
+    return entry;
+}
+
+bool SendWindow::acknowledge(sf::Uint16 sequence)
+{
+    bool acknowledged = false;
+    Send_Window_Entry_t* entry = find(sequence);
+    if(NULL != entry)
+    {
+        entry->in_use = false;
+        m_pool->release(entry->message);
+        acknowledged = true;
+
+        // Slide the window past any messages that have been acknowledged
+        while((m_oldest != m_next) &&
+              (!m_entries[m_oldest & (SEND_WINDOW_SIZE - 1)].in_use))
+        {
+            m_oldest++;
+        }
+        fill();
+    }
+    return acknowledged;
+}
+
+void SendWindow::clear()
+{
+    for(int i = 0; i < SEND_WINDOW_SIZE; i++)
+    {
+        if(m_entries[i].in_use)
+        {
+            m_pool->release(m_entries[i].message);
+            m_entries[i].in_use = false;
+        }
+    }
+    while(!m_backlog.empty())
+    {
+        m_pool->release(m_backlog.front().message);
+        m_backlog.pop_front();
+    }
+    m_oldest = 0;
+    m_next = 0;
+}
+
+// Move messages waiting in the backlog into any free window slots
+void SendWindow::fill()
+{
+    while((!m_backlog.empty()) && (getInFlight() < SEND_WINDOW_SIZE))
+    {
+        Send_Window_Entry_t* entry = &m_entries[m_next & (SEND_WINDOW_SIZE - 1)];
+        entry->msg_type = m_backlog.front().msg_type;
+        entry->message = m_backlog.front().message;
+        entry->sequence = m_next;
+        entry->in_use = true;
+        entry->TimeStarted = 0.0;
+        entry->TimeSent = 0.0;
+        entry->NumResends = 0u;
+        m_backlog.pop_front();
+        m_next++;
+    }
+}
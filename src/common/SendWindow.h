@@ -0,0 +1,84 @@
+#ifndef SENDWINDOW_H
+#define SENDWINDOW_H
+
+#include <SFML/Config.hpp>
+#include "MessagePool.h"
+#include "RingBuffer.h"
+
+// Number of guaranteed messages that can be in flight to a single
+// client at once.  Must be a power of two so that a sequence number
+// maps directly onto a slot.
+#define SEND_WINDOW_SIZE 1024
+
+// Wraparound safe comparison of 16 bit sequence numbers.
+// Returns true if s1 is more recent than s2.
+inline bool sequenceGreaterThan(sf::Uint16 s1, sf::Uint16 s2)
+{
+    return ((s1 > s2) && ((s1 - s2) <= 32768)) ||
+           ((s1 < s2) && ((s2 - s1) > 32768));
+}
+
+typedef struct{
+    // The message payload in the pool, the network header is added when sent
+    sf::Uint32 message;
+
+    // The type of message stored in this slot
+    sf::Uint8 msg_type;
+
+    // The sequence number the slot is currently holding
+    sf::Uint16 sequence;
+
+    // Set while the message is waiting for an acknowledgement
+    bool in_use;
+
+    // The time at which the message was origionally sent
+    // (0.0 if it has not been sent yet)
+    double TimeStarted;
+
+    // The time at which the message was last sent
+    double TimeSent;
+
+    // The number of times the message has been re-sent
+    sf::Uint8 NumResends;
+} Send_Window_Entry_t;
+
+/*
+ * Ring buffer of guaranteed messages that have been sent to a client
+ * but not yet acknowledged.  Entries are indexed by sequence number, so
+ * adding a message and looking one up by an ACK are both O(1), and
+ * walking the in flight messages is O(window).  Messages that do not
+ * fit in the window wait in a backlog until older messages are
+ * acknowledged.  Each message holds a reference to its pooled buffer
+ * until it is acknowledged.
+ */
+class SendWindow
+{
+    public:
+        SendWindow(MessagePool* pool);
+        // Takes over a reference to the message
+        void push(sf::Uint8 msg_type, sf::Uint32 message);
+        Send_Window_Entry_t* find(sf::Uint16 sequence);
+        bool acknowledge(sf::Uint16 sequence);
+        void clear();
+        sf::Uint16 getOldest() { return m_oldest; }
+        sf::Uint16 getNext() { return m_next; }
+        unsigned int getInFlight() { return (sf::Uint16)(m_next - m_oldest); }
+        unsigned int getBacklog() { return m_backlog.size(); }
+        bool pending() { return (getInFlight() > 0) || !m_backlog.empty(); }
+    protected:
+        typedef struct{
+            sf::Uint8 msg_type;
+            sf::Uint32 message;
+        } Backlog_Entry_t;
+
+        void fill();
+        MessagePool* m_pool;
+        Send_Window_Entry_t m_entries[SEND_WINDOW_SIZE];
+        RingBuffer<Backlog_Entry_t> m_backlog;
+        // Oldest sequence number that has not been acknowledged
+        sf::Uint16 m_oldest;
+        // Sequence number that will be assigned to the next message
+        sf::Uint16 m_next;
+};
+
+#endif
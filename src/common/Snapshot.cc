@@ -0,0 +1,195 @@
+#include "Snapshot.h"
+#include "GameParams.h"
+
+Snapshot::Snapshot()
+{
+    id = 0u;
+}
+
+void Snapshot::setPlayer(sf::Uint8 pindex, double direction, double x, double y, double hover)
+{
+    Snapshot_Player_t state;
+    state.direction = BitWriter::quantizeAngle(direction, NET_ANGLE_BITS);
+    state.x = BitWriter::quantize(x, NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+    state.y = BitWriter::quantize(y, NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+    state.hover = BitWriter::quantize(hover, 0.0, 1.0, NET_HOVER_BITS);
+    players[pindex] = state;
+}
+
+void Snapshot::getPlayer(sf::Uint8 pindex, double& direction, double& x, double& y, double& hover) const
+{
+    std::map<sf::Uint8, Snapshot_Player_t>::const_iterator iter = players.find(pindex);
+    if(players.end() != iter)
+    {
+        direction = BitReader::dequantizeAngle(iter->second.direction, NET_ANGLE_BITS);
+        x = BitReader::dequantize(iter->second.x, NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+        y = BitReader::dequantize(iter->second.y, NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+        hover = BitReader::dequantize(iter->second.hover, 0.0, 1.0, NET_HOVER_BITS);
+    }
+}
+
+// True if both snapshots hold the same players in the same state
+bool Snapshot::sameAs(const Snapshot& other) const
+{
+    if(players.size() != other.players.size())
+    {
+        return false;
+    }
+    std::map<sf::Uint8, Snapshot_Player_t>::const_iterator a = players.begin();
+    std::map<sf::Uint8, Snapshot_Player_t>::const_iterator b = other.players.begin();
+    for(; a != players.end(); a++, b++)
+    {
+        if((a->first != b->first) || !samePlayer(a->second, b->second))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Snapshot::samePlayer(const Snapshot_Player_t& a, const Snapshot_Player_t& b)
+{
+    return ((a.direction == b.direction) &&
+            (a.x == b.x) &&
+            (a.y == b.y) &&
+            (a.hover == b.hover));
+}
+
+void Snapshot::encode(BitWriter& writer, const Snapshot* baseline) const
+{
+    writer.write(id, 16);
+    writer.writeBool(NULL != baseline);
+    if(NULL != baseline)
+    {
+        writer.write(baseline->id, 16);
+    }
+    writer.write(players.size(), 8);
+
+    for(std::map<sf::Uint8, Snapshot_Player_t>::const_iterator iter = players.begin();
+        iter != players.end(); iter++)
+    {
+        const Snapshot_Player_t& state = iter->second;
+        sf::Uint32 mask = SNAPSHOT_FIELD_DIRECTION | SNAPSHOT_FIELD_X |
+                          SNAPSHOT_FIELD_Y | SNAPSHOT_FIELD_HOVER;
+        if(NULL != baseline)
+        {
+            std::map<sf::Uint8, Snapshot_Player_t>::const_iterator base = baseline->players.find(iter->first);
+            if(baseline->players.end() != base)
+            {
+                mask = 0u;
+                mask |= (state.direction != base->second.direction) ? SNAPSHOT_FIELD_DIRECTION : 0u;
+                mask |= (state.x != base->second.x) ? SNAPSHOT_FIELD_X : 0u;
+                mask |= (state.y != base->second.y) ? SNAPSHOT_FIELD_Y : 0u;
+                mask |= (state.hover != base->second.hover) ? SNAPSHOT_FIELD_HOVER : 0u;
+            }
+        }
+
+        writer.write(iter->first, 8);
+        writer.write(mask, SNAPSHOT_FIELD_BITS);
+        if(mask & SNAPSHOT_FIELD_DIRECTION)
+        {
+            writer.write(state.direction, NET_ANGLE_BITS);
+        }
+        if(mask & SNAPSHOT_FIELD_X)
+        {
+            writer.write(state.x, NET_COORD_BITS);
+        }
+        if(mask & SNAPSHOT_FIELD_Y)
+        {
+            writer.write(state.y, NET_COORD_BITS);
+        }
+        if(mask & SNAPSHOT_FIELD_HOVER)
+        {
+            writer.write(state.hover, NET_HOVER_BITS);
+        }
+    }
+}
+
+// Returns false if the message is truncated or its baseline is no
+// longer in the history, in which case the snapshot is unusable.
+bool Snapshot::decode(BitReader& reader, SnapshotHistory& history)
+{
+    const Snapshot* baseline = NULL;
+    players.clear();
+
+    id = reader.read(16);
+    if(reader.readBool())
+    {
+        baseline = history.find(reader.read(16));
+        if(NULL == baseline)
+        {
+            return false;
+        }
+    }
+
+    sf::Uint32 count = reader.read(8);
+    for(sf::Uint32 i = 0; (i < count) && !reader.overflowed(); i++)
+    {
+        sf::Uint8 pindex = reader.read(8);
+        sf::Uint32 mask = reader.read(SNAPSHOT_FIELD_BITS);
+        Snapshot_Player_t state;
+        state.direction = 0u;
+        state.x = 0u;
+        state.y = 0u;
+        state.hover = 0u;
+        if(NULL != baseline)
+        {
+            std::map<sf::Uint8, Snapshot_Player_t>::const_iterator base = baseline->players.find(pindex);
+            if(baseline->players.end() != base)
+            {
+                state = base->second;
+            }
+        }
+        if(mask & SNAPSHOT_FIELD_DIRECTION)
+        {
+            state.direction = reader.read(NET_ANGLE_BITS);
+        }
+        if(mask & SNAPSHOT_FIELD_X)
+        {
+            state.x = reader.read(NET_COORD_BITS);
+        }
+        if(mask & SNAPSHOT_FIELD_Y)
+        {
+            state.y = reader.read(NET_COORD_BITS);
+        }
+        if(mask & SNAPSHOT_FIELD_HOVER)
+        {
+            state.hover = reader.read(NET_HOVER_BITS);
+        }
+        players[pindex] = state;
+    }
+
+    return !reader.overflowed();
+}
+
+SnapshotHistory::SnapshotHistory()
+{
+    clear();
+}
+
+void SnapshotHistory::store(const Snapshot& snapshot)
+{
+    unsigned int ndx = snapshot.id & (SNAPSHOT_HISTORY_SIZE - 1);
+    m_snapshots[ndx] = snapshot;
+    m_valid[ndx] = true;
+}
+
+Snapshot* SnapshotHistory::find(sf::Uint16 id)
+{
+    unsigned int ndx = id & (SNAPSHOT_HISTORY_SIZE - 1);
+    Snapshot* snapshot = NULL;
+    if(m_valid[ndx] && (m_snapshots[ndx].id == id))
+    {
+        snapshot = &m_snapshots[ndx];
+    }
+    return snapshot;
+}
+
+void SnapshotHistory::clear()
+{
+    for(int i = 0; i < SNAPSHOT_HISTORY_SIZE; i++)
+    {
+        m_valid[i] = false;
+        m_snapshots[i].players.clear();
+    }
+}
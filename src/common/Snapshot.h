@@ -0,0 +1,81 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <map>
+#include <SFML/Config.hpp>
+#include "BitStream.h"
+
+// Number of past snapshots kept to delta against, must be a power of two
+#define SNAPSHOT_HISTORY_SIZE 32
+
+// Sequenced channel the snapshots are sent on
+#define SNAPSHOT_CHANNEL 0u
+
+// In seconds, how often the latest snapshot is re-sent to a client
+// that has not acknowledged it while nothing is changing.
+#define SNAPSHOT_RESEND_INTERVAL 0.1
+
+// Bits of the field mask in front of each player in a snapshot
+#define SNAPSHOT_FIELD_DIRECTION 0x1u
+#define SNAPSHOT_FIELD_X         0x2u
+#define SNAPSHOT_FIELD_Y         0x4u
+#define SNAPSHOT_FIELD_HOVER     0x8u
+#define SNAPSHOT_FIELD_BITS      4
+
+// Most bits the header of a snapshot, and each player in it, can take.
+// The NET_*_BITS come from GameParams.h.
+#define SNAPSHOT_HEADER_BITS (16 + 1 + 16 + 8)
+#define SNAPSHOT_PLAYER_BITS (8 + SNAPSHOT_FIELD_BITS + NET_ANGLE_BITS + 2 * NET_COORD_BITS + NET_HOVER_BITS)
+
+// State of one player.  Held quantized, so comparing against a
+// baseline finds exactly the fields that the receiver will see change.
+typedef struct{
+    sf::Uint32 direction;
+    sf::Uint32 x;
+    sf::Uint32 y;
+    sf::Uint32 hover;
+} Snapshot_Player_t;
+
+class SnapshotHistory;
+
+/*
+ * The state of every player at one point in time.
+ *
+ * A snapshot is encoded relative to a baseline snapshot the receiver
+ * is known to have:
+ *   Uint16 snapshot id
+ *   1 bit  set if a baseline is used, followed by its Uint16 id
+ *   Uint8  number of players
+ * then for each player its Uint8 index, a SNAPSHOT_FIELD_* mask and
+ * only the fields that differ from the baseline.  Players that are
+ * not in the baseline are sent with every field.
+ */
+class Snapshot
+{
+    public:
+        Snapshot();
+        void setPlayer(sf::Uint8 pindex, double direction, double x, double y, double hover);
+        void getPlayer(sf::Uint8 pindex, double& direction, double& x, double& y, double& hover) const;
+        bool sameAs(const Snapshot& other) const;
+        static bool samePlayer(const Snapshot_Player_t& a, const Snapshot_Player_t& b);
+        void encode(BitWriter& writer, const Snapshot* baseline) const;
+        bool decode(BitReader& reader, SnapshotHistory& history);
+
+        sf::Uint16 id;
+        std::map<sf::Uint8, Snapshot_Player_t> players;
+};
+
+// The most recent snapshots, looked up by id
+class SnapshotHistory
+{
+    public:
+        SnapshotHistory();
+        void store(const Snapshot& snapshot);
+        Snapshot* find(sf::Uint16 id);
+        void clear();
+    protected:
+        Snapshot m_snapshots[SNAPSHOT_HISTORY_SIZE];
+        bool m_valid[SNAPSHOT_HISTORY_SIZE];
+};
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * Bounded queue between exactly one producer thread and one consumer
+ * thread.  Neither side ever takes a lock: each index is only written
+ * by its own side, and published to the other with a release store
+ * that pairs with an acquire load, so an entry is always completely
+ * written before the consumer can see it.  The size must be a power
+ * of two.
+ */
+template <typename T>
+class SpscQueue
+{
+    public:
+        SpscQueue(unsigned int size)
+            : m_entries(size), m_mask(size - 1u), m_head(0u), m_tail(0u)
+        {
+        }
+
+        // Producer only, returns false if the queue is full
+        bool push(const T& item)
+        {
+            unsigned int tail = m_tail;
+            if((tail - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE)) > m_mask)
+            {
+                return false;
+            }
+            m_entries[tail & m_mask] = item;
+            __atomic_store_n(&m_tail, tail + 1u, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        // Producer only, the entry the next push would fill, or NULL if
+        // the queue is full.  It is filled in place and passed over with
+        // commit(), keeping whatever memory it had from last time.
+        T* reserve()
+        {
+            if(full())
+            {
+                return NULL;
+            }
+            return &m_entries[m_tail & m_mask];
+        }
+
+        // Producer only, after reserve()
+        void commit()
+        {
+            __atomic_store_n(&m_tail, m_tail + 1u, __ATOMIC_RELEASE);
+        }
+
+        // Producer only
+        bool full()
+        {
+            return ((m_tail - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE)) > m_mask);
+        }
+
+        // Consumer only, returns false if the queue is empty
+        bool pop(T& item)
+        {
+            unsigned int head = m_head;
+            if(head == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE))
+            {
+                return false;
+            }
+            item = m_entries[head & m_mask];
+            __atomic_store_n(&m_head, head + 1u, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        // Consumer only, the oldest entry, or NULL if the queue is empty.
+        // It is used in place and stays in the queue until release().
+        T* front()
+        {
+            unsigned int head = m_head;
+            if(head == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE))
+            {
+                return NULL;
+            }
+            return &m_entries[head & m_mask];
+        }
+
+        // Consumer only, after front()
+        void release()
+        {
+            __atomic_store_n(&m_head, m_head + 1u, __ATOMIC_RELEASE);
+        }
+
+        // Either side, only a hint since the other side may be busy
+        bool empty()
+        {
+            return (__atomic_load_n(&m_head, __ATOMIC_ACQUIRE) ==
+                    __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE));
+        }
+
+    protected:
+        std::vector<T> m_entries;
+        unsigned int m_mask;
+        // Next entry to pop, only written by the consumer
+        unsigned int m_head;
+        // Keep the two indices on separate cache lines
+        char m_padding[64];
+        // Next entry to push, only written by the producer
+        unsigned int m_tail;
+};
+
+#endif
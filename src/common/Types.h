@@ -4,11 +4,20 @@
 #define KEY_PRESSED         0xA5u
 #define KEY_NOT_PRESSED     0x5Au
 
+// Bits of the key mask sent in a PLAYER_UPDATE
+#define KEY_MASK_W          0x1u
+#define KEY_MASK_A          0x2u
+#define KEY_MASK_S          0x4u
+#define KEY_MASK_D          0x8u
+#define KEY_MASK_BITS       4
+
 #define PLAYER_CONNECT      0x1Au
 #define PLAYER_DISCONNECT   0x2Bu
 #define PLAYER_DEATH        0x3Cu
 #define PLAYER_UPDATE       0x4Du
 #define PLAYER_SHOT         0x5Eu
+#define WORLD_SNAPSHOT      0x6Fu
+#define SNAPSHOT_ACK        0xB2u
 
 #define TILE_DAMAGED        0xA1u
 
@@ -0,0 +1,331 @@
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <map>
+#include "Server.h"
+#include "GameParams.h"
+#include "NetCapture.h"
+#include "NetCompress.h"
+#include "NetHeader.h"
+
+// Sizes of the fixed header and message framing the compact ones replaced
+#define FIXED_DATAGRAM_HEADER_SIZE 18
+#define FIXED_MESSAGE_HEADER_SIZE 5
+
+/*
+ * Run the message compression over every message payload in a capture,
+ * by message type and direction, and print how well it does and how
+ * long it takes.
+ */
+static bool benchmark_codec(const char *filename)
+{
+    NetCapture capture;
+    NetCapture_Record_t record;
+    // Payloads by direction and message type
+    std::map<int, std::vector<std::vector<char> > > payloads;
+    if(!capture.open(filename))
+    {
+        return false;
+    }
+    while(capture.read(record))
+    {
+        if(record.data.empty())
+        {
+            continue;
+        }
+        DatagramReader reader(&record.data[0], record.data.size());
+        Datagram_Header_t header;
+        sf::Uint8 msg_type;
+        sf::Uint16 sequence;
+        const char *payload;
+        sf::Uint16 length;
+        if(!reader.readHeader(header))
+        {
+            continue;
+        }
+        while(reader.readMessage(msg_type, sequence, payload, length))
+        {
+            if(length > 0u)
+            {
+                int key = (record.direction << 8) | (msg_type & ~NETWORK_COMPRESSED_FLAG);
+                payloads[key].push_back(std::vector<char>(payload, payload + length));
+            }
+        }
+    }
+
+    NetCompress codec;
+    std::vector<char> out;
+    printf("%-9s %4s %8s %10s %7s %12s %12s\n", "direction", "type", "messages", "bytes", "ratio",
+           "compress", "decompress");
+    for(std::map<int, std::vector<std::vector<char> > >::iterator iter = payloads.begin();
+        iter != payloads.end(); iter++)
+    {
+        std::vector<std::vector<char> >& messages = iter->second;
+        std::vector<std::vector<char> > compressed(messages.size());
+        std::size_t bytes_in = 0u;
+        std::size_t bytes_out = 0u;
+        sf::Clock timer;
+        for(unsigned int i = 0; i < messages.size(); i++)
+        {
+            std::size_t size = codec.compress(&messages[i][0], messages[i].size(), out);
+            // Sent as it is if it does not come out smaller
+            compressed[i].assign(out.begin(), out.begin() + size);
+            bytes_in += messages[i].size();
+            bytes_out += (size > 0u) ? size : messages[i].size();
+        }
+        double compress_time = timer.getElapsedTime().asSeconds();
+
+        std::vector<char> back;
+        int failures = 0;
+        timer.restart();
+        for(unsigned int i = 0; i < messages.size(); i++)
+        {
+            if(!compressed[i].empty())
+            {
+                back.resize(messages[i].size());
+                if((!NetCompress::decompress(&compressed[i][0], compressed[i].size(), &back[0], back.size())) ||
+                   (0 != memcmp(&back[0], &messages[i][0], back.size())))
+                {
+                    failures++;
+                }
+            }
+        }
+        double decompress_time = timer.getElapsedTime().asSeconds();
+
+        double kilobytes = bytes_in / 1024.0;
+        printf("%-9s %4d %8u %10u %7.3f %8.2f us/KB %8.2f us/KB\n",
+               ((iter->first >> 8) == NETCAPTURE_SENT) ? "sent" : "received", iter->first & 0xFF,
+               (unsigned int)messages.size(), (unsigned int)bytes_in, (double)bytes_out / bytes_in,
+               compress_time * 1000000.0 / kilobytes, decompress_time * 1000000.0 / kilobytes);
+        if(failures > 0)
+        {
+            printf("  %d messages did not decompress to the original\n", failures);
+        }
+    }
+    return true;
+}
+
+/*
+ * Take every datagram in a capture apart and put it back together
+ * again, timing both, and compare the size of the headers with the
+ * fixed ones they replaced.
+ */
+static bool benchmark_header(const char *filename)
+{
+    NetCapture capture;
+    NetCapture_Record_t record;
+    std::vector<std::vector<char> > datagrams;
+    if(!capture.open(filename))
+    {
+        return false;
+    }
+    while(capture.read(record))
+    {
+        if(!record.data.empty())
+        {
+            datagrams.push_back(record.data);
+        }
+    }
+
+    // Enough passes to time even a short capture
+    const int passes = 100;
+    sf::Uint32 protocol_id = NetHeader::getProtocolId();
+    Datagram_Header_t header;
+    sf::Uint8 msg_type;
+    sf::Uint16 sequence;
+    const char *payload;
+    sf::Uint16 length;
+    unsigned int rejected = 0u;
+    unsigned int handshakes = 0u;
+    unsigned int messages = 0u;
+    std::size_t bytes = 0u;
+    std::size_t header_bytes = 0u;
+    std::size_t framing_bytes = 0u;
+    sf::Clock timer;
+    for(int pass = 0; pass < passes; pass++)
+    {
+        for(unsigned int i = 0; i < datagrams.size(); i++)
+        {
+            DatagramReader reader(&datagrams[i][0], datagrams[i].size());
+            if(!reader.readHeader(header))
+            {
+                rejected++;
+                continue;
+            }
+            // The tokens are not known here, so only the handshakes
+            // pass the check, but it takes as long either way
+            if(reader.check(protocol_id, 0u) && (0 == pass))
+            {
+                handshakes++;
+            }
+            std::size_t offset = reader.getOffset();
+            if(0 == pass)
+            {
+                header_bytes += offset + NETHEADER_CHECK_SIZE;
+                bytes += datagrams[i].size();
+            }
+            while(reader.readMessage(msg_type, sequence, payload, length))
+            {
+                if(0 == pass)
+                {
+                    framing_bytes += reader.getOffset() - offset - length;
+                    messages++;
+                }
+                offset = reader.getOffset();
+            }
+        }
+    }
+    double read_time = timer.getElapsedTime().asSeconds();
+
+    // Written back out the same way Network does, which must give the
+    // same bytes up to the check
+    sf::Packet datagram;
+    DatagramWriter writer;
+    int mismatches = 0;
+    timer.restart();
+    for(int pass = 0; pass < passes; pass++)
+    {
+        for(unsigned int i = 0; i < datagrams.size(); i++)
+        {
+            DatagramReader reader(&datagrams[i][0], datagrams[i].size());
+            if(!reader.readHeader(header))
+            {
+                continue;
+            }
+            writer.begin(datagram, header);
+            std::size_t offset = reader.getOffset();
+            while(reader.readMessage(msg_type, sequence, payload, length))
+            {
+                bool has_sequence = (0u != (datagrams[i][offset] & NETHEADER_SEQUENCE_FLAG));
+                writer.appendMessage(datagram, msg_type, has_sequence, sequence, payload, length);
+                offset = reader.getOffset();
+            }
+            writer.finish(datagram, protocol_id, 0u);
+            if((0 == pass) && ((datagram.getDataSize() != datagrams[i].size()) ||
+                               (0 != memcmp(datagram.getData(), &datagrams[i][0], datagrams[i].size() - NETHEADER_CHECK_SIZE))))
+            {
+                mismatches++;
+            }
+        }
+    }
+    double write_time = timer.getElapsedTime().asSeconds();
+
+    unsigned int count = datagrams.size() - rejected / passes;
+    // The same payloads with the fixed header and framing
+    double fixed_bytes = (double)(bytes - header_bytes - framing_bytes) +
+                         (double)count * FIXED_DATAGRAM_HEADER_SIZE + (double)messages * FIXED_MESSAGE_HEADER_SIZE;
+    printf("%u datagrams, %u handshakes, %u messages, %u bytes\n", count, handshakes, messages, (unsigned int)bytes);
+    printf("header   %6.2f bytes a datagram, fixed %d\n", (double)header_bytes / count, FIXED_DATAGRAM_HEADER_SIZE);
+    printf("framing  %6.2f bytes a message, fixed %d\n", (double)framing_bytes / messages, FIXED_MESSAGE_HEADER_SIZE);
+    printf("saved    %6.2f%% of the bytes sent\n", 100.0 * (fixed_bytes - bytes) / fixed_bytes);
+    printf("read and check %8.1f ns a datagram\n", read_time * 1e9 / ((double)passes * datagrams.size()));
+    printf("write          %8.1f ns a datagram\n", write_time * 1e9 / ((double)passes * datagrams.size()));
+    if(mismatches > 0)
+    {
+        printf("  %d datagrams did not come out the same\n", mismatches);
+    }
+    return true;
+}
+
+/*
+ * Feed a capture made with the server's --capture option back into a
+ * server, to profile a real match offline or compare builds on the
+ * same traffic.
+ */
+int main(int argc, char *argv[])
+{
+    double report_interval = 0.0;
+    double interest_radius = INTEREST_RADIUS;
+    double client_budget = CLIENT_BUDGET;
+    bool fast = false;
+    bool compress = false;
+    bool codec = false;
+    bool header = false;
+    for (;;)
+    {
+        static struct option long_options[] = {
+            {"fast", no_argument, 0, 'f'},
+            {"compress", no_argument, 0, 'c'},
+            {"codec", no_argument, 0, 'C'},
+            {"header", no_argument, 0, 'H'},
+            {"stats", required_argument, 0, 's'},
+            {"interest-radius", required_argument, 0, 'r'},
+            {"budget", required_argument, 0, 'b'},
+            {NULL, 0, 0, 0}
+        };
+        int opt_index = 0;
+        int c = getopt_long(argc, argv, "fcCHs:r:b:",
+                long_options, &opt_index);
+        if (c == -1)
+            break;
+        switch (c)
+        {
+            case 'f':
+                fast = true;
+                break;
+            case 'c':
+                compress = true;
+                break;
+            case 'C':
+                codec = true;
+                break;
+            case 'H':
+                header = true;
+                break;
+            case 's':
+                report_interval = atof(optarg);
+                break;
+            case 'r':
+                interest_radius = atof(optarg);
+                break;
+            case 'b':
+                client_budget = atof(optarg);
+                break;
+        }
+    }
+    if (optind >= argc)
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--fast] [--compress] [--codec] [--header] [--stats seconds] [--interest-radius r]"
+                  << " [--budget bytes] capture-file\n";
+        return 1;
+    }
+
+    // Only measure the compression on the captured messages
+    if (codec)
+    {
+        if (!benchmark_codec(argv[optind]))
+        {
+            std::cerr << "Could not read capture file " << argv[optind] << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    // Only measure the datagram headers
+    if (header)
+    {
+        if (!benchmark_header(argv[optind]))
+        {
+            std::cerr << "Could not read capture file " << argv[optind] << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    // The socket is never used, so keep it off the game port
+    Server server(sf::Socket::AnyPort);
+    server.set_report_interval(report_interval);
+    server.set_interest_radius(interest_radius);
+    server.set_client_budget(client_budget);
+    server.set_compression(compress);
+    if (!server.replay(argv[optind], fast))
+    {
+        std::cerr << "Could not read capture file " << argv[optind] << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,12 +1,33 @@
 #include "Server.h"
 #include "Types.h"
+#include "GameParams.h"
+#include "BitStream.h"
 #include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <iostream>
+#ifdef SERVER_USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
 
 Server::Server(sf::Uint16 port)
 {
     m_net_server = new Network();
     m_net_server->Create(port, sf::IpAddress::None);
     m_players.clear();
+    m_tick_stats.last = 0.0;
+    m_tick_stats.max = 0.0;
+    m_tick_stats.total = 0.0;
+    m_tick_stats.count = 0u;
+    m_report_interval = 0.0;
+    m_last_report = 0.0;
+    m_game_time = 0.0;
+    m_interest_radius = INTEREST_RADIUS;
+    m_client_budget = CLIENT_BUDGET;
 }
 
 Server::~Server()
@@ -16,9 +37,13 @@ Server::~Server()
 
 void Server::run( void )
 {
+#ifdef SERVER_USE_EPOLL
+    // Only comes back if epoll could not be used
+    run_reactor();
+#endif
     double current_time;
     double elapsed_time;
-    double last_time = 0.0;
+    double last_time = m_clock.getElapsedTime().asSeconds();
     while(1)
     {
         current_time = m_clock.getElapsedTime().asSeconds();
@@ -27,38 +52,367 @@ void Server::run( void )
         update( elapsed_time );
         last_time = current_time;
 
+        report();
+
         // temporary for now.  otherwise this thread consumed way too processing
-        sf::sleep(sf::seconds(0.005)); // 5 milli-seconds
+        sf::sleep(sf::seconds(SERVER_TICK_PERIOD));
+    }
+}
+
+#ifdef SERVER_USE_EPOLL
+/*
+ * Block until either messages arrive or the next tick is due.
+ * Received messages are handled (and answered) straight away, while the
+ * game is only stepped on the tick timer.  With no clients connected the
+ * timer is disarmed and the server sleeps until someone sends a packet.
+ * Returns if any of it fails, for run() to poll instead.
+ */
+void Server::run_reactor( void )
+{
+    int epoll_fd = epoll_create(2);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    // With a network thread the socket is none of our business, it says
+    // when it has passed messages over instead.
+    bool threaded = m_net_server->isThreaded();
+    int watch_fd = threaded ? m_net_server->getWakeHandle() : (int)m_net_server->getSocketHandle();
+    struct epoll_event ev;
+    bool timer_armed = false;
+    double next_deadline = 0.0;
+    double last_time = 0.0;
+
+    bool ok = (epoll_fd >= 0) && (timer_fd >= 0) && (watch_fd >= 0);
+    if(ok)
+    {
+        ev.events = EPOLLIN;
+        ev.data.fd = watch_fd;
+        ok = (0 == epoll_ctl(epoll_fd, EPOLL_CTL_ADD, watch_fd, &ev));
+    }
+    if(ok)
+    {
+        ev.events = EPOLLIN;
+        ev.data.fd = timer_fd;
+        ok = (0 == epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev));
+    }
+
+    while(ok)
+    {
+        struct epoll_event events[2];
+        bool active = (m_net_server->getNumConnected() > 0) ||
+                      m_net_server->pendingMessages();
+
+        // Only tick while there is someone to tick for
+        if(active != timer_armed)
+        {
+            struct itimerspec spec;
+            long period_ns = (long)(SERVER_TICK_PERIOD * 1000000000.0);
+            spec.it_interval.tv_sec = 0;
+            spec.it_interval.tv_nsec = active ? period_ns : 0;
+            spec.it_value = spec.it_interval;
+            if(0 != timerfd_settime(timer_fd, 0, &spec, NULL))
+            {
+                ok = false;
+                break;
+            }
+            timer_armed = active;
+
+            // Don't let the idle time count as one huge step
+            last_time = m_clock.getElapsedTime().asSeconds();
+            next_deadline = last_time + SERVER_TICK_PERIOD;
+        }
+
+        int num_events = epoll_wait(epoll_fd, events, 2, -1);
+        if(num_events < 0)
+        {
+            if(EINTR == errno)
+            {
+                continue;
+            }
+            ok = false;
+            break;
+        }
+        for(int i = 0; i < num_events; i++)
+        {
+            if(events[i].data.fd == watch_fd)
+            {
+                if(threaded)
+                {
+                    uint64_t count = 0;
+                    if(read(watch_fd, &count, sizeof(count)) != sizeof(count))
+                    {
+                        continue;
+                    }
+                }
+                m_net_server->Receive();
+                process_messages();
+                m_net_server->Transmit();
+            }
+            else if(events[i].data.fd == timer_fd)
+            {
+                uint64_t expirations = 0;
+                if((read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) &&
+                   (expirations > 0))
+                {
+                    double current_time = m_clock.getElapsedTime().asSeconds();
+                    record_tick_lateness(current_time - next_deadline);
+                    next_deadline += expirations * SERVER_TICK_PERIOD;
+
+                    update(current_time - last_time);
+                    last_time = current_time;
+                    report();
+                }
+            }
+        }
+    }
+
+    std::cout << "Error, could not wait in epoll (" << strerror(errno) << "), polling instead\n";
+    if(epoll_fd >= 0)
+    {
+        close(epoll_fd);
+    }
+    if(timer_fd >= 0)
+    {
+        close(timer_fd);
     }
 }
+#endif
 
+/*
+ * Run the game on the traffic in a capture file instead of the socket,
+ * then print how much processor time it took, so builds can be compared
+ * on the same traffic.  Nothing is really sent, the clients in the
+ * capture go on as they did whatever the server answers.  A fast replay
+ * steps the game and the network clock by exactly one tick at a time.
+ */
+bool Server::replay(const char *filename, bool fast)
+{
+    if(!m_net_server->startReplay(filename, fast))
+    {
+        return false;
+    }
+    clock_t cpu_start = clock();
+    double start_time = m_clock.getElapsedTime().asSeconds();
+    double last_time = start_time;
+    sf::Uint32 ticks = 0u;
+    while(m_net_server->replayPending())
+    {
+        if(fast)
+        {
+            m_net_server->advanceReplay(SERVER_TICK_PERIOD);
+            update(SERVER_TICK_PERIOD);
+        }
+        else
+        {
+            double current_time = m_clock.getElapsedTime().asSeconds();
+            update(current_time - last_time);
+            last_time = current_time;
+            sf::sleep(sf::seconds(SERVER_TICK_PERIOD));
+        }
+        ticks++;
+        report();
+    }
+    double cpu_time = (double)(clock() - cpu_start) / CLOCKS_PER_SEC;
+    std::cout << "replayed " << ticks << " ticks in "
+              << m_clock.getElapsedTime().asSeconds() - start_time << " s, "
+              << cpu_time << " s of processor time ("
+              << ((ticks > 0u) ? (cpu_time * 1000000.0 / ticks) : 0.0) << " us per tick)\n";
+    return true;
+}
+
+void Server::record_tick_lateness(double lateness)
+{
+    if(lateness < 0.0)
+    {
+        lateness = 0.0;
+    }
+    m_tick_stats.last = lateness;
+    m_tick_stats.total += lateness;
+    m_tick_stats.count++;
+    if(lateness > m_tick_stats.max)
+    {
+        m_tick_stats.max = lateness;
+    }
+}
+
+// Periodically print the server statistics, if enabled
+void Server::report( void )
+{
+    double current_time = m_game_time;
+    if((m_report_interval > 0.0) &&
+       ((current_time - m_last_report) >= m_report_interval))
+    {
+        m_last_report = current_time;
+        if(m_tick_stats.count > 0u)
+        {
+            std::cout << "tick lateness (ms): last " << m_tick_stats.last * 1000.0
+                      << " avg " << m_tick_stats.total * 1000.0 / m_tick_stats.count
+                      << " max " << m_tick_stats.max * 1000.0
+                      << " over " << m_tick_stats.count << " ticks\n";
+        }
+        m_tick_stats.max = 0.0;
+        m_tick_stats.total = 0.0;
+        m_tick_stats.count = 0u;
+
+        // How much of their bandwidth budget the clients are using
+        double total_use = 0.0;
+        double max_use = 0.0;
+        sf::Uint8 max_pindex = 0u;
+        sf::Uint32 deferred = 0u;
+        unsigned int num_clients = 0u;
+        for(std::map<sf::Uint8, refptr<Player> >::iterator piter = m_players.begin(); piter != m_players.end(); piter++)
+        {
+            Budget_Stats_t& stats = piter->second->m_budget_stats;
+            if(stats.given > 0.0)
+            {
+                double use = stats.used / stats.given;
+                total_use += use;
+                if(use > max_use)
+                {
+                    max_use = use;
+                    max_pindex = piter->first;
+                }
+                deferred += stats.deferred;
+                num_clients++;
+            }
+            stats.given = 0.0;
+            stats.used = 0.0;
+            stats.deferred = 0u;
+        }
+        if(num_clients > 0u)
+        {
+            std::cout << "budget use: avg " << total_use * 100.0 / num_clients
+                      << "% max " << max_use * 100.0 << "% (player " << (int)max_pindex
+                      << ") deferred " << deferred << " updates\n";
+        }
+
+        // State of the links to the clients, counted since each connected
+        Connection_Stats_t net_stats;
+        double worst_p95 = 0.0;
+        double worst_loss = 0.0;
+        double ack_latency = 0.0;
+        sf::Uint32 ack_count = 0u;
+        sf::Uint32 resends = 0u;
+        sf::Uint32 max_send_queue = 0u;
+        unsigned int num_links = 0u;
+        for(std::map<sf::Uint8, refptr<Player> >::iterator piter = m_players.begin(); piter != m_players.end(); piter++)
+        {
+            if(m_net_server->getConnectionStats(piter->second->m_client, net_stats))
+            {
+                double p95 = Network::getRttPercentile(net_stats, 0.95);
+                if(p95 > worst_p95)
+                {
+                    worst_p95 = p95;
+                }
+                if(net_stats.loss > worst_loss)
+                {
+                    worst_loss = net_stats.loss;
+                }
+                if(net_stats.send_queue > max_send_queue)
+                {
+                    max_send_queue = net_stats.send_queue;
+                }
+                ack_latency += net_stats.ack_latency_total;
+                ack_count += net_stats.ack_latency_count;
+                resends += net_stats.resends;
+                num_links++;
+            }
+        }
+        if(num_links > 0u)
+        {
+            Coalesce_Stats_t coalesce = m_net_server->getCoalesceStats();
+            std::cout << "network: worst rtt p95 " << worst_p95 * 1000.0
+                      << " ms, worst loss " << worst_loss * 100.0
+                      << "%, avg ack " << ((ack_count > 0u) ? (ack_latency * 1000.0 / ack_count) : 0.0)
+                      << " ms, " << resends << " resends, max send queue " << max_send_queue
+                      << ", " << coalesce.messages_sent << " messages in " << coalesce.datagrams_sent
+                      << " datagrams, " << m_net_server->getAllocationCount() << " pool buffers, "
+                      << m_net_server->getDroppedCount() << " dropped\n";
+        }
+        Compression_Stats_t compression = m_net_server->getCompressionStats();
+        if(compression.bytes_in > 0u)
+        {
+            std::cout << "compression: " << compression.messages_compressed << " messages compressed, "
+                      << compression.messages_skipped << " skipped, ratio "
+                      << (double)compression.bytes_out / compression.bytes_in << ", "
+                      << compression.seconds * 1000000.0 * 1024.0 / compression.bytes_in << " us/KB\n";
+        }
+    }
+}
+
+
+// The player controlled by a client, or zero if it has none
+sf::Uint8 Server::get_client_player(Client_Id_t client)
+{
+    sf::Uint16 handle = NETWORK_CLIENT_HANDLE(client);
+    if((handle >= m_client_players.size()) || (m_client_players[handle].first != client))
+    {
+        return 0u;
+    }
+    return m_client_players[handle].second;
+}
+
+void Server::set_client_player(Client_Id_t client, sf::Uint8 pindex)
+{
+    sf::Uint16 handle = NETWORK_CLIENT_HANDLE(client);
+    if(handle >= m_client_players.size())
+    {
+        m_client_players.resize(handle + 1u, std::make_pair((Client_Id_t)NETWORK_NO_CLIENT, (sf::Uint8)0u));
+    }
+    m_client_players[handle] = std::make_pair(client, pindex);
+}
+
+// Build the PLAYER_CONNECT message announcing a player, with the port
+// filled in only for the client that the player belongs to.
+void Server::make_player_connect(sf::Packet& packet, sf::Uint8 pindex, sf::Uint16 port)
+{
+    refptr<Player> player = m_players[pindex];
+    packet.clear();
+    packet << (sf::Uint8)PLAYER_CONNECT;
+    packet << pindex;
+    packet << player->name;
+    packet << port;
+    // Send correct starting locations so that they match
+    // the other players screens.
+    packet << player->direction;
+    packet << player->x;
+    packet << player->y;
+}
 
 void Server::update( double elapsed_time )
 {
-    static Player player_prev;
-    const double move_speed = 50.0;
+    m_game_time += elapsed_time;
+    m_net_server->Receive();
+    process_messages();
+    simulate(elapsed_time);
+    send_snapshots(elapsed_time);
+    m_net_server->Transmit();
+}
+
+void Server::process_messages( void )
+{
+    // Read in place in the buffers the messages were received into
+    PacketView message;
     sf::Packet server_packet;
-    sf::Uint8 tmp_player_client;
+    Client_Id_t tmp_player_client;
 
-    m_net_server->Receive();
     // Handle all received data (only really want the latest)
-    while(m_net_server->getData(server_packet, &tmp_player_client))
+    while(m_net_server->getMessage(message, &tmp_player_client))
     {
         sf::Uint8 ptype;
         // Get packet type
-        server_packet >> ptype;
+        message >> ptype;
         switch(ptype)
         {
             case PLAYER_CONNECT:
             {
                 sf::Uint16 players_port = sf::Socket::AnyPort;
                 refptr<Player> p = new Player();
+                p->m_snapshots = new SnapshotHistory();
                 std::string pname;
                 sf::Uint8 pindex;
 
-                server_packet >> pindex;
-                server_packet >> pname;
-                server_packet >> players_port;
+                message >> pindex;
+                message >> pname;
+                message >> players_port;
                 // When a player connects, we need to associate
                 // that player with a new ID. find first unused id
                 // player zero means a player does not exist.
@@ -72,25 +426,24 @@ void Server::update( double elapsed_time )
                         }
                     }
                     p->name = pname;
-                    p->m_client = m_net_server->getClient(tmp_player_client);
+                    p->m_client = tmp_player_client;
                     m_players[pindex] = p;
+                    set_client_player(tmp_player_client, pindex);
+
+                    // The players already in the game only need to hear
+                    // about the new one.
+                    make_player_connect(server_packet, pindex, players_port);
+                    m_net_server->sendToGroup(server_packet, SERVER_GROUP_PLAYING, true);
 
-                    // Alert all connected clients of all the connected players.
+                    // Only the new player needs the whole list, including
+                    // itself.
                     for(std::map<sf::Uint8, refptr<Player> >::iterator piter = m_players.begin(); piter !=  m_players.end(); piter++)
                     {
                         sf::Uint16 port = ((piter->first == pindex) ? players_port : 0u);
-                        server_packet.clear();
-                        server_packet << ptype;
-                        server_packet << piter->first;
-                        server_packet << piter->second->name;
-                        server_packet << port;
-                        // Send correct starting locations so that they match
-                        // the other players screens.
-                        server_packet << piter->second->direction;
-                        server_packet << piter->second->x;
-                        server_packet << piter->second->y;
-                        m_net_server->sendData(server_packet, true);
+                        make_player_connect(server_packet, piter->first, port);
+                        m_net_server->sendTo(server_packet, p->m_client, true);
                     }
+                    m_net_server->setClientGroups(p->m_client, SERVER_GROUP_PLAYING);
                 }
                 break;
             }
@@ -98,16 +451,38 @@ void Server::update( double elapsed_time )
             {
                 // Need to determine the correct player id
                 // then update the stored contents.
+                BitReader reader(message.getData() + 1, message.getDataSize() - 1);
+                sf::Uint8 pindex = reader.read(8);
+                sf::Uint32 keys = reader.read(KEY_MASK_BITS);
+                sf::Int32 rel_mouse_movement = reader.readSigned(NET_MOUSE_BITS);
+                if((!reader.overflowed()) &&
+                   (m_players.end() != m_players.find(pindex)) &&
+                   (get_client_player(tmp_player_client) == pindex))
+                {
+                    m_players[pindex]->w_pressed = (keys & KEY_MASK_W) ? KEY_PRESSED : KEY_NOT_PRESSED;
+                    m_players[pindex]->a_pressed = (keys & KEY_MASK_A) ? KEY_PRESSED : KEY_NOT_PRESSED;
+                    m_players[pindex]->s_pressed = (keys & KEY_MASK_S) ? KEY_PRESSED : KEY_NOT_PRESSED;
+                    m_players[pindex]->d_pressed = (keys & KEY_MASK_D) ? KEY_PRESSED : KEY_NOT_PRESSED;
+                    m_players[pindex]->rel_mouse_movement = rel_mouse_movement;
+                }
+                break;
+            }
+            case SNAPSHOT_ACK:
+            {
                 sf::Uint8 pindex;
-                server_packet >> pindex;
+                sf::Uint16 snapshot_id;
+                message >> pindex;
+                message >> snapshot_id;
                 if((m_players.end() != m_players.find(pindex)) &&
-                   (m_net_server->getClient(tmp_player_client) == m_players[pindex]->m_client))
+                   (get_client_player(tmp_player_client) == pindex))
                 {
-                    server_packet >> m_players[pindex]->w_pressed;
-                    server_packet >> m_players[pindex]->a_pressed;
-                    server_packet >> m_players[pindex]->s_pressed;
-                    server_packet >> m_players[pindex]->d_pressed;
-                    server_packet >> m_players[pindex]->rel_mouse_movement;
+                    // Acknowledgements can arrive out of order
+                    if((!m_players[pindex]->m_snapshot_acked) ||
+                       sequenceGreaterThan(snapshot_id, m_players[pindex]->m_snapshot_ack))
+                    {
+                        m_players[pindex]->m_snapshot_ack = snapshot_id;
+                        m_players[pindex]->m_snapshot_acked = true;
+                    }
                 }
                 break;
             }
@@ -117,12 +492,13 @@ void Server::update( double elapsed_time )
                 std::size_t num_erased = 0;
                 // This completely removes the player from the game
                 // Deletes member from the player list
-                server_packet >> pindex;
+                message >> pindex;
                 if((m_players.end() != m_players.find(pindex)) &&
-                   (m_net_server->getClient(tmp_player_client) == m_players[pindex]->m_client))
+                   (get_client_player(tmp_player_client) == pindex))
                 {
                     // Tell networking code to remove the client.
                     m_net_server->disconnectClient(m_players[pindex]->m_client);
+                    set_client_player(tmp_player_client, 0u);
                     num_erased = m_players.erase(pindex);
                     if(1 == num_erased)
                     {
@@ -144,12 +520,13 @@ void Server::update( double elapsed_time )
             
             case PLAYER_SHOT:
             {
-                sf::Uint8 pindex;
-                double shot_distance;
-                server_packet >> pindex;
-                server_packet >> shot_distance;
+                BitReader reader(message.getData() + 1, message.getDataSize() - 1);
+                sf::Uint8 pindex = reader.read(8);
+                double shot_distance = reader.readQuantized(0.0, MAX_SHOT_DISTANCE, NET_SHOT_DISTANCE_BITS);
                 // start the shot process if a player is allowed to shoot and exits
-                if((m_players.end() != m_players.find(pindex)) &&
+                if((!reader.overflowed()) &&
+                   (m_players.end() != m_players.find(pindex)) &&
+                   (get_client_player(tmp_player_client) == pindex) &&
                    (m_players[pindex]->m_shot_allowed))
                 {               
                     // Perhaps sometime in the future, the shots will
@@ -162,13 +539,15 @@ void Server::update( double elapsed_time )
                     m_players[pindex]->m_shot_allowed = false;  
                     
                     // Send a packet to all players that a shot has been fired
+                    BitWriter writer;
+                    writer.write(pindex, 8);
+                    writer.writeQuantized(m_players[pindex]->x, NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+                    writer.writeQuantized(m_players[pindex]->y, NET_COORD_MIN, NET_COORD_MAX, NET_COORD_BITS);
+                    writer.writeAngle(m_players[pindex]->direction, NET_ANGLE_BITS);
+                    writer.writeQuantized(shot_distance, 0.0, MAX_SHOT_DISTANCE, NET_SHOT_DISTANCE_BITS);
                     server_packet.clear();
                     server_packet << ptype;
-                    server_packet << pindex;
-                    server_packet << m_players[pindex]->x;
-                    server_packet << m_players[pindex]->y;
-                    server_packet << m_players[pindex]->direction;
-                    server_packet << shot_distance;                    
+                    writer.appendTo(server_packet);
                     m_net_server->sendData(server_packet, true);
                 }
                 break;
@@ -181,6 +560,12 @@ void Server::update( double elapsed_time )
             }
         }
     }
+}
+
+void Server::simulate( double elapsed_time )
+{
+    const double move_speed = 50.0;
+    sf::Packet server_packet;
 
     for(std::map<sf::Uint8, refptr<Player> >::iterator piter = m_players.begin(); piter !=  m_players.end();)
     {
@@ -189,7 +574,8 @@ void Server::update( double elapsed_time )
         // erasing of players will not cause issues
         piter++;
 
-        if(m_players[pindex]->m_client->disconnect == CONNECTED)
+        Disconnect_States_t state = m_net_server->getClientState(m_players[pindex]->m_client);
+        if(state == CONNECTED)
         {
             /* decrease player hover when not over a tile */
             if((m_players[pindex]->hover > 0) &&
@@ -284,28 +670,16 @@ void Server::update( double elapsed_time )
                 }
             }
             
-            server_packet.clear();
-
-            // Send the player update if there were changes
-            if(m_players[pindex]->updated)
-            {
-                sf::Uint8 ptype = PLAYER_UPDATE;
-                server_packet << ptype;
-                server_packet << pindex;
-                server_packet << m_players[pindex]->direction;
-                server_packet << m_players[pindex]->x;
-                server_packet << m_players[pindex]->y;
-                server_packet << m_players[pindex]->hover;
-                m_net_server->sendData(server_packet);
-                m_players[pindex]->updated = false;
-           }
         }
         else
         {
-            if(m_players[pindex]->m_client->disconnect == TIMEOUT_DISCONNECT)
+            // The network frees the slot of a client that timed out by
+            // itself if the player is not removed soon enough.
+            if((state == TIMEOUT_DISCONNECT) || (state == DISCONNECTED))
             {
                 // Tell networking code to remove the client.
                 m_net_server->disconnectClient(m_players[pindex]->m_client);
+                set_client_player(m_players[pindex]->m_client, 0u);
 
                 if(m_players.erase(pindex))
                 {
@@ -319,5 +693,238 @@ void Server::update( double elapsed_time )
             }
         }
     }
-    m_net_server->Transmit();
+}
+
+// True if other should be kept fully up to date on the client of viewer
+bool Server::is_interesting(refptr<Player> viewer, refptr<Player> other)
+{
+    if((m_interest_radius <= 0.0) || (&*viewer == &*other))
+    {
+        return true;
+    }
+    double dx = other->x - viewer->x;
+    double dy = other->y - viewer->y;
+    double distance_squared = dx * dx + dy * dy;
+    if(distance_squared <= (m_interest_radius * m_interest_radius))
+    {
+        return true;
+    }
+    if(distance_squared > (4.0 * m_interest_radius * m_interest_radius))
+    {
+        return false;
+    }
+    // Within the view cone in front of the tank
+    double distance = sqrt(distance_squared);
+    return ((dx * cos(viewer->direction) + dy * sin(viewer->direction)) >=
+            (distance * cos(INTEREST_VIEW_ANGLE)));
+}
+
+// Priority per second that the state of other builds up with the
+// client of viewer.  Players the client is interested in reach the
+// send threshold of 1 every tick, closer ones sooner, while the rest
+// only reach it every INTEREST_FAR_INTERVAL.
+double Server::get_priority_weight(refptr<Player> viewer, refptr<Player> other)
+{
+    if(&*viewer == &*other)
+    {
+        return PRIORITY_SELF_WEIGHT / SERVER_TICK_PERIOD;
+    }
+    if(!is_interesting(viewer, other))
+    {
+        return 1.0 / INTEREST_FAR_INTERVAL;
+    }
+    double weight = 1.0 / SERVER_TICK_PERIOD;
+    if(m_interest_radius > 0.0)
+    {
+        double dx = other->x - viewer->x;
+        double dy = other->y - viewer->y;
+        double closeness = 1.0 - sqrt(dx * dx + dy * dy) / (2.0 * m_interest_radius);
+        if(closeness > 0.0)
+        {
+            weight *= 1.0 + closeness;
+        }
+    }
+    return weight;
+}
+
+/*
+ * Take a snapshot of the world as each client should see it, and send
+ * the client the difference between it and the last snapshot that
+ * client acknowledged.  If the client has not acknowledged anything
+ * still in its history it is sent the whole snapshot.
+ *
+ * Each player's state builds up priority with each client over time,
+ * weighted by get_priority_weight().  Once it reaches 1 the player is
+ * due to be sent, and the due players are put in the snapshot highest
+ * priority first for as long as they fit in the client's byte budget.
+ * Players that are not sent keep the state they had in the client's
+ * previous snapshot, and their priority, so they go first next time.
+ * A snapshot never holds more than SNAPSHOT_MAX_PLAYERS, so even one
+ * sent without a baseline fits in a datagram.  Once it is full, players
+ * the client has not been sent yet wait for one of the others to leave.
+ */
+void Server::send_snapshots(double elapsed_time)
+{
+    double current_time = m_game_time;
+
+    // The state of every player now, shared by all the clients
+    Snapshot current;
+    for(std::map<sf::Uint8, refptr<Player> >::iterator piter = m_players.begin(); piter != m_players.end(); piter++)
+    {
+        refptr<Player> other = piter->second;
+        if(m_net_server->getClientState(other->m_client) == CONNECTED)
+        {
+            current.setPlayer(piter->first, other->direction, other->x, other->y, other->hover);
+        }
+    }
+
+    for(std::map<sf::Uint8, refptr<Player> >::iterator viter = m_players.begin(); viter != m_players.end(); viter++)
+    {
+        refptr<Player> viewer = viter->second;
+        viewer->updated = false;
+        if(m_net_server->getClientState(viewer->m_client) != CONNECTED)
+        {
+            continue;
+        }
+
+        if(m_client_budget > 0.0)
+        {
+            double allowance = m_client_budget * elapsed_time;
+            viewer->m_budget += allowance;
+            viewer->m_budget_stats.given += allowance;
+            if(viewer->m_budget > CLIENT_BUDGET_BURST)
+            {
+                viewer->m_budget = CLIENT_BUDGET_BURST;
+            }
+        }
+
+        // Start from what the client was last sent, and find the
+        // players that have changed and are due to be sent again.
+        Snapshot snapshot;
+        std::vector<std::pair<double, sf::Uint8> > due;
+        for(std::map<sf::Uint8, Snapshot_Player_t>::iterator citer = current.players.begin(); citer != current.players.end(); citer++)
+        {
+            double& priority = viewer->m_priority[citer->first];
+            std::map<sf::Uint8, Snapshot_Player_t>::iterator last = viewer->m_last_snapshot.players.find(citer->first);
+            if((viewer->m_last_snapshot.players.end() != last) &&
+               Snapshot::samePlayer(last->second, citer->second))
+            {
+                // Nothing new to tell the client
+                snapshot.players[citer->first] = citer->second;
+                priority = 0.0;
+                continue;
+            }
+
+            priority += get_priority_weight(viewer, m_players[citer->first]) * elapsed_time;
+            if(viewer->m_last_snapshot.players.end() == last)
+            {
+                // A player the client has never been sent is due now
+                if(priority < 1.0)
+                {
+                    priority = 1.0;
+                }
+            }
+            else
+            {
+                snapshot.players[citer->first] = last->second;
+            }
+
+            if(priority >= 1.0)
+            {
+                due.push_back(std::make_pair(priority, citer->first));
+            }
+        }
+
+        std::sort(due.begin(), due.end());
+        double cost = 0.0;
+        for(std::vector<std::pair<double, sf::Uint8> >::reverse_iterator diter = due.rbegin(); diter != due.rend(); diter++)
+        {
+            if((snapshot.players.end() == snapshot.players.find(diter->second)) &&
+               (snapshot.players.size() >= SNAPSHOT_MAX_PLAYERS))
+            {
+                viewer->m_budget_stats.deferred++;
+                continue;
+            }
+            if((m_client_budget > 0.0) &&
+               ((cost + SNAPSHOT_PLAYER_COST) > viewer->m_budget))
+            {
+                viewer->m_budget_stats.deferred++;
+                continue;
+            }
+            cost += SNAPSHOT_PLAYER_COST;
+            snapshot.players[diter->second] = current.players[diter->second];
+            viewer->m_priority[diter->second] = 0.0;
+        }
+
+        // Only start a new snapshot when something the client can see changed
+        bool changed = false;
+        if(!snapshot.sameAs(viewer->m_last_snapshot))
+        {
+            snapshot.id = viewer->m_last_snapshot.id + 1u;
+            viewer->m_snapshots->store(snapshot);
+            viewer->m_last_snapshot = snapshot;
+            changed = true;
+        }
+
+        bool up_to_date = viewer->m_snapshot_acked &&
+                          (viewer->m_snapshot_ack == viewer->m_last_snapshot.id);
+        if(up_to_date ||
+           ((!changed) && (((current_time - viewer->m_snapshot_sent) < SNAPSHOT_RESEND_INTERVAL) ||
+                           ((m_client_budget > 0.0) && (viewer->m_budget <= 0.0)))))
+        {
+            continue;
+        }
+
+        Snapshot* baseline = NULL;
+        if(viewer->m_snapshot_acked)
+        {
+            baseline = viewer->m_snapshots->find(viewer->m_snapshot_ack);
+        }
+
+        sf::Uint8 ptype = WORLD_SNAPSHOT;
+        sf::Packet server_packet;
+        BitWriter writer;
+        viewer->m_last_snapshot.encode(writer, baseline);
+        server_packet << ptype;
+        writer.appendTo(server_packet);
+        // Only the newest snapshot matters to the client.  If it could
+        // not be queued it is tried again next tick.
+        if(!m_net_server->sendSequenced(server_packet, SNAPSHOT_CHANNEL, viewer->m_client))
+        {
+            continue;
+        }
+        viewer->m_snapshot_sent = current_time;
+
+        // Charge only what was queued, which includes any changes the
+        // client has not acknowledged yet: the channel byte, the message
+        // and its framing, rather than the most framing could take.
+        std::size_t queued = server_packet.getDataSize() + 1u;
+        double used = queued + DatagramWriter::getFirstFramingSize(true, queued);
+        viewer->m_budget_stats.used += used;
+        if(m_client_budget > 0.0)
+        {
+            viewer->m_budget -= used;
+        }
+    }
+}
+
+bool Server::get_connection_stats(sf::Uint8 pindex, Connection_Stats_t& stats)
+{
+    std::map<sf::Uint8, refptr<Player> >::iterator iter = m_players.find(pindex);
+    if(m_players.end() == iter)
+    {
+        return false;
+    }
+    return m_net_server->getConnectionStats(iter->second->m_client, stats);
+}
+
+bool Server::get_budget_stats(sf::Uint8 pindex, Budget_Stats_t& stats)
+{
+    std::map<sf::Uint8, refptr<Player> >::iterator iter = m_players.find(pindex);
+    if(m_players.end() == iter)
+    {
+        return false;
+    }
+    stats = iter->second->m_budget_stats;
+    return true;
 }
@@ -3,17 +3,98 @@
 #include "refptr.h"
 #include "SFML/Config.hpp"
 #include "Map.h"
+#include "Snapshot.h"
+
+// On Linux the server blocks in epoll on the socket and a tick timer
+// instead of polling.  Define SERVER_NO_EPOLL to use the polling loop.
+#if defined(__linux__) && !defined(SERVER_NO_EPOLL)
+#define SERVER_USE_EPOLL
+#endif
+
+// In seconds
+#define SERVER_TICK_PERIOD 0.005
+
+// Players within this distance of a tank, or within twice the distance
+// and in front of it, are sent to its client every tick.  The others
+// are only brought up to date every INTEREST_FAR_INTERVAL seconds.
+#define INTEREST_RADIUS 300.0
+// Half angle of the view cone, in radians
+#define INTEREST_VIEW_ANGLE 0.7853981633974483
+#define INTEREST_FAR_INTERVAL 0.25
+
+// Bytes per second of snapshot data each client can be sent, and the
+// most unused budget that can build up for a burst.
+#define CLIENT_BUDGET 32000.0
+#define CLIENT_BUDGET_BURST NETWORK_MAX_PAYLOAD
+// Estimated bytes taken by one changed player in a snapshot
+#define SNAPSHOT_PLAYER_COST 8
+// Most players a snapshot can hold and still be sent whole in one
+// datagram, after its type byte and the channel byte
+#define SNAPSHOT_MAX_PLAYERS (((NETWORK_MAX_PAYLOAD - 2) * 8 - SNAPSHOT_HEADER_BITS) / SNAPSHOT_PLAYER_BITS)
+// How much faster a client's own player gains priority than others
+#define PRIORITY_SELF_WEIGHT 4.0
+
+// Network group of the clients that have joined the game
+#define SERVER_GROUP_PLAYING 0x1u
+
+// How late the tick wakeups were compared to their deadlines, in seconds
+typedef struct{
+    double last;
+    double max;
+    double total;
+    sf::Uint32 count;
+} Tick_Stats_t;
 
 class Server{
     public:
         Server(sf::Uint16 port);
         ~Server();
         void run( void );
+        void set_report_interval(double seconds) { m_report_interval = seconds; }
+        // Zero sends every player to every client at the full rate
+        void set_interest_radius(double radius) { m_interest_radius = radius; }
+        // Bytes per second, zero sends everything that changed
+        void set_client_budget(double bytes_per_second) { m_client_budget = bytes_per_second; }
+        bool get_budget_stats(sf::Uint8 pindex, Budget_Stats_t& stats);
+        bool get_connection_stats(sf::Uint8 pindex, Connection_Stats_t& stats);
+        void set_netsim(const NetSim_Config_t& config) { m_net_server->setNetSim(config); }
+        // Do the socket work on a thread of its own, see Network::startThread()
+        void start_io_thread() { m_net_server->startThread(); }
+        // Compress reliable messages, see NETWORK_COMPRESS_THRESHOLD
+        void set_compression(bool enabled) { m_net_server->setCompression(enabled); }
+        // Record all traffic to a file, see Network::startCapture()
+        bool start_capture(const char *filename) { return m_net_server->startCapture(filename); }
+        bool replay(const char *filename, bool fast);
+        const Tick_Stats_t & get_tick_stats() { return m_tick_stats; }
 
     protected:
         void update(double elapsed_time);
+        void process_messages();
+        void simulate(double elapsed_time);
+        void send_snapshots(double elapsed_time);
+        bool is_interesting(refptr<Player> viewer, refptr<Player> other);
+        double get_priority_weight(refptr<Player> viewer, refptr<Player> other);
+        sf::Uint8 get_client_player(Client_Id_t client);
+        void set_client_player(Client_Id_t client, sf::Uint8 pindex);
+        void make_player_connect(sf::Packet& packet, sf::Uint8 pindex, sf::Uint16 port);
+        void record_tick_lateness(double lateness);
+        void report();
+#ifdef SERVER_USE_EPOLL
+        void run_reactor();
+#endif
         refptr<Network> m_net_server;
         std::map<sf::Uint8, refptr<Player> > m_players;
+        // Client id and player index for each client handle, the
+        // player index is zero if the client has no player
+        std::vector<std::pair<Client_Id_t, sf::Uint8> > m_client_players;
         sf::Clock m_clock;
+        // Sum of the steps given to update(), so in a fast replay the
+        // game runs on the replay clock rather than m_clock
+        double m_game_time;
         Map m_map;
+        Tick_Stats_t m_tick_stats;
+        double m_report_interval;
+        double m_last_report;
+        double m_interest_radius;
+        double m_client_budget;
 };
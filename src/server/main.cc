@@ -1,19 +1,35 @@
 #include <getopt.h>
 #include <stdlib.h>
+#include <iostream>
 #include "Server.h"
 #include "GameParams.h"
 
 int main(int argc, char *argv[])
 {
     int port = DEFAULT_PORT;
+    double report_interval = 0.0;
+    double interest_radius = INTEREST_RADIUS;
+    double client_budget = CLIENT_BUDGET;
+    bool io_thread = false;
+    const char *capture_file = NULL;
+    bool compress = false;
+    NetSim_Config_t netsim;
+    NetSim::defaults(netsim);
     for (;;)
     {
         static struct option long_options[] = {
             {"port", required_argument, 0, 'p'},
+            {"stats", required_argument, 0, 's'},
+            {"interest-radius", required_argument, 0, 'r'},
+            {"netsim", required_argument, 0, 'n'},
+            {"budget", required_argument, 0, 'b'},
+            {"io-thread", no_argument, 0, 't'},
+            {"capture", required_argument, 0, 'c'},
+            {"compress", no_argument, 0, 'z'},
             {NULL, 0, 0, 0}
         };
         int opt_index = 0;
-        int c = getopt_long(argc, argv, "p:",
+        int c = getopt_long(argc, argv, "p:s:r:n:b:tc:z",
                 long_options, &opt_index);
         if (c == -1)
             break;
@@ -22,10 +38,49 @@ int main(int argc, char *argv[])
             case 'p':
                 port = atoi(optarg);
                 break;
+            case 's':
+                report_interval = atof(optarg);
+                break;
+            case 'r':
+                interest_radius = atof(optarg);
+                break;
+            case 'b':
+                client_budget = atof(optarg);
+                break;
+            case 't':
+                io_thread = true;
+                break;
+            case 'c':
+                capture_file = optarg;
+                break;
+            case 'z':
+                compress = true;
+                break;
+            case 'n':
+                if (!NetSim::parse(optarg, netsim))
+                {
+                    std::cerr << "Invalid --netsim settings: " << optarg << "\n";
+                    return 1;
+                }
+                break;
         }
     }
 
     Server server(port);
+    server.set_report_interval(report_interval);
+    server.set_interest_radius(interest_radius);
+    server.set_client_budget(client_budget);
+    server.set_netsim(netsim);
+    server.set_compression(compress);
+    if((NULL != capture_file) && !server.start_capture(capture_file))
+    {
+        std::cerr << "Could not create capture file " << capture_file << "\n";
+        return 1;
+    }
+    if(io_thread)
+    {
+        server.start_io_thread();
+    }
 
     server.run();
 